@@ -0,0 +1,80 @@
+﻿
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// 性能测试共用的小工具. 性能测试不在 ctest 里跑, 直接运行, 结果打在标准输出上
+
+// 跑 repeat 次 fn, 返回最快的一次用了多少毫秒
+template<typename Fn>
+double best_of(int repeat, Fn&& fn)
+{
+	double best = 1e300;
+	for (int i = 0; i < repeat; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		best = std::min(best, elapsed);
+	}
+	return best;
+}
+
+// 不让编译器把结果没人用的计算整个优化掉
+inline void keep(std::size_t value)
+{
+	static volatile std::size_t sink;
+	sink = sink + value;
+}
+
+// 一部剧的名字: 两三个假名音节拼成的词, 不同的剧基本不会重名
+inline std::string series_title(std::size_t series)
+{
+	static const char* const syllables[] = {"ka", "shi", "to", "ne", "mu", "ra", "yo", "ki", "sa", "no", "ha", "ri",
+		"ta", "ko", "mi", "su", "re", "n", "go", "zu", "be", "chi", "wa", "fu"};
+	std::string title;
+	auto seed = series * 0x9E3779B97F4A7C15ull + 1;
+	for (int word = 0; word < 3; word++)
+	{
+		if (word != 0)
+			title += ' ';
+		auto begin = title.size();
+		for (int i = 0; i < 3; i++)
+		{
+			seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+			title += syllables[(seed >> 33) % std::size(syllables)];
+		}
+		title[begin] = static_cast<char>(title[begin] - 'a' + 'A');
+	}
+	return title;
+}
+
+// 一个番剧库的文件名: 每部剧 episodes 集, 每三部剧有一部在第 13 集换了字幕组, 命名格式也跟着换了
+inline std::vector<std::string> library_names(std::size_t count, std::size_t episodes = 24)
+{
+	static const char* const groups[] = {"SubsPlease", "Erai-raws", "LoliHouse", "VCB-Studio", "Nekomoe kissaten"};
+	static const char* const tags[] = {"[1080p]", "[1080p][HEVC]", "[WEB-DL 1080p AAC]", "(BDRip 1920x1080 x265 10bit FLAC)", "[720p]"};
+
+	std::vector<std::string> names;
+	names.reserve(count);
+	for (std::size_t i = 0; i < count; i++)
+	{
+		auto series = i / episodes;
+		auto episode = std::to_string(i % episodes + 1);
+		if (episode.size() == 1)
+			episode.insert(0, "0");
+		auto title = series_title(series);
+		auto group = groups[series % std::size(groups)];
+
+		if (series % 3 == 0 && i % episodes >= 12)
+			names.push_back(title + ".E" + episode + ".[" + groups[(series + 1) % std::size(groups)] + "].mkv");
+		else
+			names.push_back("[" + std::string{group} + "] " + title + " - " + episode + " " + tags[series % std::size(tags)] + ".mkv");
+	}
+	return names;
+}
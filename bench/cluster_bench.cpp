@@ -0,0 +1,46 @@
+﻿
+#include <algorithm>
+#include <cstdio>
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+
+#include "bench_util.hpp"
+#include "file_table.hpp"
+#include "series_cluster.hpp"
+#include "tag_matcher.hpp"
+
+// --cluster=template 和 --cluster=fuzzy 在 10 万个文件名上的耗时.
+// 名字数量翻倍, 时间也应该大约翻倍, 不能是平方增长
+int main()
+{
+	tag_matcher tags;
+	for (std::size_t count : {25000, 50000, 100000})
+	{
+		// 和 main.cpp 一样, 分组用的是屏蔽了发布标签的 stem
+		file_table table;
+		for (auto& name : library_names(count))
+			table.add(name);
+		table.build_keys(tags);
+		std::vector<std::string_view> masked_names;
+		for (std::uint32_t row = 0; row < table.size(); row++)
+			masked_names.push_back(table.masked_stem(row));
+
+		std::size_t template_clusters = 0, fuzzy_clusters = 0;
+		auto template_ms = best_of(3, [&]
+		{
+			string_pool pool;
+			auto cluster_of = cluster_by_template(masked_names, pool);
+			template_clusters = *std::ranges::max_element(cluster_of) + 1;
+		});
+		auto fuzzy_ms = best_of(3, [&]
+		{
+			auto cluster_of = cluster_by_similarity(masked_names);
+			fuzzy_clusters = *std::ranges::max_element(cluster_of) + 1;
+		});
+
+		std::printf("%zu names (%zu series): template %.1f ms, %zu clusters; fuzzy %.1f ms (%.0f ns/name), %zu clusters\n",
+			count, count / 24, template_ms, template_clusters, fuzzy_ms, fuzzy_ms * 1e6 / count, fuzzy_clusters);
+	}
+	return 0;
+}
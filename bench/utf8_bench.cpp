@@ -0,0 +1,123 @@
+﻿
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bench_util.hpp"
+#include "utf8_codec.hpp"
+
+// 旧版 generic_string.hpp 里的 from_utf8, 原样搬过来做对照: 不校验, 每个码点 push_back 一次
+static std::wstring baseline_from_utf8(std::string_view utf8_str)
+{
+	std::wstring ret;
+	ret.reserve(utf8_str.size());
+
+	for (auto p = utf8_str.begin(); p != utf8_str.end(); p++)
+	{
+		unsigned char c = *p;
+		if (c <= 0b01111111)
+		{
+			ret.push_back(static_cast<wchar_t>(c));
+		}
+		else if ( c <= 0b11011111 )
+		{
+			p++;
+			unsigned char c2 = *p;
+			ret.push_back(static_cast<wchar_t>( ((c&0b11111) << 6) + (c2 & 0b111111)));
+		}
+		else if ( c <= 0b11101111 )
+		{
+			p++;
+			unsigned char c2 = *p;
+			p++;
+			unsigned char c3 = *p;
+			ret.push_back(static_cast<wchar_t>( ((c&0b1111) << 12) + ((c2 & 0b111111)<< 6) + (c3 &0b111111)));
+		}
+		else if ( c <= 0b11110111 )
+		{
+			p++;
+			unsigned char c2 = *p;
+			p++;
+			unsigned char c3 = *p;
+			p++;
+			unsigned char c4 = *p;
+			ret.push_back(static_cast<wchar_t>( ((c&0b111) << 18) + ((c2 & 0b111111)<< 12) + ((c3 &0b111111)<<6) + (c4&0b111111)));
+		}
+		else
+		{
+			continue;
+		}
+	}
+	return ret;
+}
+
+// 和 basic_generic_string::from_utf8 一样直接解码进结果里
+template<std::size_t (*Decode)(const char*, std::size_t, wchar_t*)>
+static std::wstring decode(std::string_view utf8_str)
+{
+	std::wstring ret;
+	ret.resize_and_overwrite(utf8_str.size(), [&](wchar_t* buf, std::size_t)
+	{
+		return Decode(utf8_str.data(), utf8_str.size(), buf);
+	});
+	return ret;
+}
+
+// 中日韩文字和 ASCII 混在一起的文件名, 像 "[字幕组] 进击的巨人 Kashito - 第05话 [1080p].mkv"
+static std::vector<std::string> mixed_names(std::size_t count)
+{
+	static const char* const groups[] = {"[喵萌奶茶屋]", "[LoliHouse]", "[桜都字幕组]", "[SubsPlease]"};
+	static const char* const titles[] = {"进击的巨人", "葬送のフリーレン", "間諜家家酒", "鬼灭之刃", "チェンソーマン"};
+	std::vector<std::string> names;
+	names.reserve(count);
+	for (std::size_t i = 0; i < count; i++)
+	{
+		auto series = i / 24;
+		char episode[32];
+		std::snprintf(episode, sizeof(episode), " - 第%02zu话 [1080p].mkv", i % 24 + 1);
+		names.push_back(std::string(groups[series % std::size(groups)]) + " " + titles[series % std::size(titles)] + " "
+			+ series_title(series) + episode);
+	}
+	return names;
+}
+
+// 旧的逐字节 from_utf8, 新的标量实现, 按 CPU 选出来的实现, 解码同一批文件名
+int main()
+{
+	auto names = mixed_names(200000);
+	std::size_t bytes = 0;
+	for (auto& name : names)
+		bytes += name.size();
+
+	for (auto& name : names)
+	{
+		if (baseline_from_utf8(name) != decode<utf8::decode<wchar_t>>(name) || baseline_from_utf8(name) != decode<utf8::decode_scalar<wchar_t>>(name))
+		{
+			std::printf("mismatch: %s\n", name.c_str());
+			return 1;
+		}
+	}
+
+	std::size_t chars = 0;
+	auto baseline_ms = best_of(5, [&]
+	{
+		for (auto& name : names)
+			chars += baseline_from_utf8(name).size();
+	});
+	auto scalar_ms = best_of(5, [&]
+	{
+		for (auto& name : names)
+			chars += decode<utf8::decode_scalar<wchar_t>>(name).size();
+	});
+	auto decode_ms = best_of(5, [&]
+	{
+		for (auto& name : names)
+			chars += decode<utf8::decode<wchar_t>>(name).size();
+	});
+	keep(chars);
+
+	std::printf("%zu names, %zu bytes: old loop %.1f ms, new scalar %.1f ms, dispatched %.1f ms (%.1fx faster than the old loop)\n",
+		names.size(), bytes, baseline_ms, scalar_ms, decode_ms, baseline_ms / decode_ms);
+	return 0;
+}
@@ -0,0 +1,75 @@
+﻿
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "bench_util.hpp"
+#include "output_sink.hpp"
+#include "playlist_format.hpp"
+
+// 写播放列表用了多少次 write 系统调用.
+// 以前的写法每一行都 std::endl, 一行一次 write; 现在整个渲染好以后一次写出去.
+// 系统调用次数从 /proc/self/io 的 syscw 读, 只有 Linux 上有, 别的系统上是 -1
+static long long write_syscalls()
+{
+	std::ifstream io("/proc/self/io");
+	std::string key;
+	long long value;
+	while (io >> key >> value)
+	{
+		if (key == "syscw:")
+			return value;
+	}
+	return -1;
+}
+
+int main()
+{
+	auto file = std::filesystem::temp_directory_path() / "createplaylist-writer-bench.m3u8";
+
+	for (std::size_t count : {1000, 10000, 100000})
+	{
+		auto names = library_names(count);
+		std::vector<playlist_entry> entries;
+		for (auto& name : names)
+			entries.push_back({name, name});
+
+		std::error_code ec;
+		long long per_line_calls = 0, buffered_calls = 0;
+
+		// 以前的 do_outputs
+		auto per_line_ms = best_of(3, [&]
+		{
+			auto before = write_syscalls();
+			{
+				std::ofstream out(file);
+				out << "#EXTM3U" << std::endl;
+				out << "#EXT-X-TITLE: auto-play-all" << std::endl;
+				for (auto& e : entries)
+					out << "#EXTINF:-1," << e.title << std::endl << e.path << std::endl;
+			}
+			per_line_calls = before < 0 ? -1 : write_syscalls() - before;
+		});
+
+		// 现在的 do_outputs. 先删掉文件, 不然内容没变的话一次都不写
+		auto buffered_ms = best_of(3, [&]
+		{
+			std::filesystem::remove(file, ec);
+			auto before = write_syscalls();
+			render_buffer buf;
+			render_playlist<m3u8_format>(buf, entries, "auto-play-all");
+			output_sink::to_file(file).write(buf);
+			buffered_calls = before < 0 ? -1 : write_syscalls() - before;
+		});
+
+		std::printf("%zu entries: std::endl per line %lld write calls, %.1f ms; render_buffer + output_sink %lld write calls, %.1f ms\n",
+			count, per_line_calls, per_line_ms, buffered_calls, buffered_ms);
+	}
+
+	std::error_code ec;
+	std::filesystem::remove(file, ec);
+	return 0;
+}
@@ -0,0 +1,57 @@
+﻿
+#pragma once
+
+#include <filesystem>
+#include <system_error>
+
+#include "nowide/cstdlib.hpp"
+#ifdef _WIN32
+#include "nowide/convert.hpp"
+#endif
+
+// 缓存文件存放的目录.
+// Linux 下遵循 XDG, 也就是 $XDG_CACHE_HOME/createplaylist 或者 ~/.cache/createplaylist
+// Windows 下是 %LOCALAPPDATA%\createplaylist
+// 返回空路径表示没有地方可以放缓存, 调用方应该直接不用缓存.
+inline std::filesystem::path default_cache_directory()
+{
+	std::filesystem::path dir;
+
+#ifdef _WIN32
+	if (auto local_app_data = nowide::getenv("LOCALAPPDATA"))
+		dir = std::filesystem::path(nowide::widen(local_app_data));
+#else
+	if (auto xdg_cache = nowide::getenv("XDG_CACHE_HOME"); xdg_cache && *xdg_cache)
+		dir = xdg_cache;
+	else if (auto home = nowide::getenv("HOME"); home && *home)
+		dir = std::filesystem::path(home) / ".cache";
+#endif
+
+	if (dir.empty())
+		return {};
+
+	dir /= "createplaylist";
+
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+	if (ec)
+		return {};
+	return dir;
+}
+
+// 用户配置文件存放的目录, $XDG_CONFIG_HOME/createplaylist 或者 ~/.config/createplaylist
+// Windows 下是 %APPDATA%\createplaylist
+// 和缓存目录不同, 这里不会去创建目录
+inline std::filesystem::path default_config_directory()
+{
+#ifdef _WIN32
+	if (auto app_data = nowide::getenv("APPDATA"))
+		return std::filesystem::path(nowide::widen(app_data)) / "createplaylist";
+#else
+	if (auto xdg_config = nowide::getenv("XDG_CONFIG_HOME"); xdg_config && *xdg_config)
+		return std::filesystem::path(xdg_config) / "createplaylist";
+	else if (auto home = nowide::getenv("HOME"); home && *home)
+		return std::filesystem::path(home) / ".config" / "createplaylist";
+#endif
+	return {};
+}
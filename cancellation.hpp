@@ -0,0 +1,48 @@
+﻿
+#pragma once
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+#include <stop_token>
+
+// 下游提前不要了的时候 (createplaylist | head -1, 播放器只取了第一个), 让各个阶段尽快停下来.
+// 不靠 SIGPIPE 把进程打死: 各个阶段在自己的循环里调用 poll(), 一旦发现管道的读端关了,
+// 或者别处 request_stop() 过, 就不再往下做. 并行的探测线程也看同一个 stop_source.
+class cancellation
+{
+public:
+	// watch_fd 是要盯着的输出管道, -1 表示只看 request_stop
+	explicit cancellation(int watch_fd = -1)
+		: fd_(watch_fd)
+	{}
+
+	void request_stop() { source_.request_stop(); }
+
+	std::stop_token token() const { return source_.get_token(); }
+
+	// 要不要停下来. 不阻塞, 可以在多个线程里同时调用
+	bool poll()
+	{
+		if (source_.stop_requested())
+			return true;
+#ifndef _WIN32
+		if (fd_ >= 0)
+		{
+			// 写端不关心可读可写, 读端全关了的时候内核会报 POLLERR
+			pollfd pfd{fd_, 0, 0};
+			if (::poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLERR | POLLHUP)))
+			{
+				source_.request_stop();
+				return true;
+			}
+		}
+#endif
+		return false;
+	}
+
+private:
+	std::stop_source source_;
+	int fd_;
+};
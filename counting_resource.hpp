@@ -0,0 +1,259 @@
+﻿
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// 流水线上的各个阶段, 分配按当前所在的阶段记账
+enum class alloc_stage : std::uint8_t
+{
+	other,
+	// 列举目录, 建文件表
+	scan,
+	// 屏蔽标签, 生成排序键和数字段表
+	keys,
+	sort,
+	// 分组, 检测 第几集, 去重
+	detect,
+	// 探测视频头, 渲染和写出播放列表
+	output,
+};
+
+inline constexpr std::size_t alloc_stage_count = 6;
+
+inline const char* alloc_stage_name(alloc_stage stage)
+{
+	constexpr const char* names[alloc_stage_count] = {"other", "scan", "keys", "sort", "detect", "output"};
+	return names[static_cast<std::size_t>(stage)];
+}
+
+// 记账用的 memory_resource: 分配转给 upstream, 顺便按阶段记下次数, 字节数, 大小分布和峰值.
+// 阶段由 alloc_stage_scope 标在当前线程上, 一个阶段结束就恢复成之前的阶段.
+// 每块内存前面多分配 alignment 个字节, 最后一个字节记着分配时的阶段, 释放记回分配它的阶段,
+// 不管释放的时候流水线走到了哪里.
+//
+// 计数器是每个线程一份的 (thread_local), 热路径上只有几次不带锁的加法, 平时开着也没什么开销.
+// 线程退出的时候把自己的计数并进总账, report() 的时候再加上还活着的线程.
+// 计数器是全局的, 同时只应该有一个 counting_resource.
+class counting_resource : public std::pmr::memory_resource
+{
+public:
+	// 分配大小按 2 的幂分桶: 第 i 个桶是 (2^(i-1), 2^i], 最后一个桶是所有更大的
+	static constexpr std::size_t histogram_buckets = 16;
+
+	struct stage_stats
+	{
+		std::uint64_t allocations = 0;
+		std::uint64_t bytes = 0;
+		std::uint64_t deallocations = 0;
+		std::uint64_t freed_bytes = 0;
+		// 这个阶段里出现过的最大在用字节数 (各个线程的峰值相加, 是个上限)
+		std::uint64_t peak_bytes = 0;
+		std::array<std::uint64_t, histogram_buckets> histogram{};
+	};
+
+	using report_type = std::array<stage_stats, alloc_stage_count>;
+
+	explicit counting_resource(std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+		: upstream_(upstream)
+	{}
+
+	counting_resource(const counting_resource&) = delete;
+	counting_resource& operator=(const counting_resource&) = delete;
+
+	// upstream 整个释放过了 (run_arena::reset), 当前线程的在用字节数从零开始重新算
+	void upstream_released()
+	{
+		counters().live.store(0, std::memory_order_relaxed);
+	}
+
+	// 所有线程的计数加在一起
+	static report_type report()
+	{
+		auto& r = registry();
+		std::lock_guard lock(r.mutex);
+		auto result = r.retired;
+		for (auto c : r.threads)
+			c->merge_into(result);
+		return result;
+	}
+
+	// 当前线程现在所在的阶段
+	static alloc_stage current_stage()
+	{
+		return current_stage_ref();
+	}
+
+private:
+	friend class alloc_stage_scope;
+
+	static alloc_stage& current_stage_ref()
+	{
+		thread_local alloc_stage stage = alloc_stage::other;
+		return stage;
+	}
+
+	// 只有所属的线程会写, 别的线程 (report) 只会读, 所以用不带 lock 前缀的 load + store
+	struct counter
+	{
+		std::atomic<std::uint64_t> value{0};
+
+		void add(std::uint64_t n) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+		void raise_to(std::uint64_t n)
+		{
+			if (n > value.load(std::memory_order_relaxed))
+				value.store(n, std::memory_order_relaxed);
+		}
+		std::uint64_t get() const { return value.load(std::memory_order_relaxed); }
+	};
+
+	struct thread_counters
+	{
+		struct stage_counters
+		{
+			counter allocations, bytes, deallocations, freed_bytes, peak_bytes;
+			std::array<counter, histogram_buckets> histogram;
+		};
+
+		std::array<stage_counters, alloc_stage_count> stages;
+		// 当前线程分配出去还没还回来的字节数
+		std::atomic<std::uint64_t> live{0};
+
+		thread_counters()
+		{
+			auto& r = registry();
+			std::lock_guard lock(r.mutex);
+			r.threads.push_back(this);
+		}
+
+		~thread_counters()
+		{
+			auto& r = registry();
+			std::lock_guard lock(r.mutex);
+			merge_into(r.retired);
+			std::erase(r.threads, this);
+		}
+
+		void merge_into(report_type& result) const
+		{
+			for (std::size_t s = 0; s < alloc_stage_count; s++)
+			{
+				auto& from = stages[s];
+				auto& to = result[s];
+				to.allocations += from.allocations.get();
+				to.bytes += from.bytes.get();
+				to.deallocations += from.deallocations.get();
+				to.freed_bytes += from.freed_bytes.get();
+				to.peak_bytes += from.peak_bytes.get();
+				for (std::size_t b = 0; b < histogram_buckets; b++)
+					to.histogram[b] += from.histogram[b].get();
+			}
+		}
+	};
+
+	struct registry_type
+	{
+		std::mutex mutex;
+		std::vector<thread_counters*> threads;
+		// 已经退出的线程的计数
+		report_type retired{};
+	};
+
+	static registry_type& registry()
+	{
+		static registry_type r;
+		return r;
+	}
+
+	static thread_counters& counters()
+	{
+		thread_local thread_counters c;
+		return c;
+	}
+
+	static std::size_t bucket_of(std::size_t bytes)
+	{
+		return std::min<std::size_t>(std::bit_width(bytes == 0 ? 0 : bytes - 1), histogram_buckets - 1);
+	}
+
+	// 头部就是 alignment 个字节, 这样返回的指针照样是对齐的
+	static std::size_t header_size(std::size_t alignment)
+	{
+		return alignment;
+	}
+
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		auto stage = current_stage_ref();
+		auto header = header_size(alignment);
+		auto p = static_cast<std::byte*>(upstream_->allocate(bytes + header, alignment)) + header;
+		p[-1] = static_cast<std::byte>(stage);
+
+		auto& c = counters();
+		auto& s = c.stages[static_cast<std::size_t>(stage)];
+		s.allocations.add(1);
+		s.bytes.add(bytes);
+		s.histogram[bucket_of(bytes)].add(1);
+		auto live = c.live.load(std::memory_order_relaxed) + bytes;
+		c.live.store(live, std::memory_order_relaxed);
+		s.peak_bytes.raise_to(live);
+		return p;
+	}
+
+	void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override
+	{
+		auto p = static_cast<std::byte*>(ptr);
+		auto stage = static_cast<std::size_t>(p[-1]);
+		auto header = header_size(alignment);
+		upstream_->deallocate(p - header, bytes + header, alignment);
+
+		auto& c = counters();
+		auto& s = c.stages[stage];
+		s.deallocations.add(1);
+		s.freed_bytes.add(bytes);
+		// 别的线程分配, 这个线程释放的时候可能减过头
+		auto live = c.live.load(std::memory_order_relaxed);
+		c.live.store(live > bytes ? live - bytes : 0, std::memory_order_relaxed);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+
+	std::pmr::memory_resource* upstream_;
+};
+
+// 在作用域里把当前线程标成 stage, 离开作用域恢复成原来的阶段
+class alloc_stage_scope
+{
+public:
+	explicit alloc_stage_scope(alloc_stage stage)
+		: saved_(std::exchange(counting_resource::current_stage_ref(), stage))
+	{}
+
+	// 流水线往下走了一个阶段, 还是在同一个作用域里
+	void enter(alloc_stage stage)
+	{
+		counting_resource::current_stage_ref() = stage;
+	}
+
+	alloc_stage_scope(const alloc_stage_scope&) = delete;
+	alloc_stage_scope& operator=(const alloc_stage_scope&) = delete;
+
+	~alloc_stage_scope()
+	{
+		counting_resource::current_stage_ref() = saved_;
+	}
+
+private:
+	alloc_stage saved_;
+};
@@ -0,0 +1,165 @@
+﻿
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <memory_resource>
+#include <span>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "hash_util.hpp"
+#include "tag_matcher.hpp"
+
+// 同一集有好几个版本的时候 (E05.720p / E05.1080p, E05 / E05v2), 只保留最好的那个.
+//
+// 先把每个文件解析成 (季, 集) 的 key, 用 hash 一遍扫描分组 (hash 撞了就换个种子接着找, 分组按的是确切的 (季, 集)),
+// 组内按 分辨率 > 版本号 > 文件大小 > 文件名 的顺序挑最好的, 所以结果是确定的,
+// 而且不需要两两比较文件.
+struct episode_variant
+{
+	long season = 0;
+	long episode = -1;
+	int resolution = 0;
+	int version = 0;
+	// 季和集的数字在文件名里的位置, 终端上高亮用. 长度是 0 表示没有
+	std::uint32_t season_begin = 0;
+	std::uint32_t season_length = 0;
+	std::uint32_t episode_begin = 0;
+	std::uint32_t episode_length = 0;
+};
+
+// 从 "[Grp] Show S01E05v2 [1080p]" 这样的文件名里解析出各个字段.
+// digi_for_episode 是 find_digi_for_episode 找到的 第几集 所在的位置.
+// 分辨率只从 tags (tag_matcher 在 name 里找到的标签) 里读, 剧名或者集数里的 "720" 不会被当成分辨率
+inline episode_variant parse_episode_variant(std::string_view name, int digi_for_episode, std::span<const tag_matcher::span> tags = {})
+{
+	episode_variant v;
+
+	auto is_digit = [](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; };
+	auto read_number = [&](std::size_t& pos)
+	{
+		long n = 0;
+		for (; pos < name.size() && is_digit(name[pos]); pos++)
+			n = n * 10 + (name[pos] - '0');
+		return n;
+	};
+
+	if (digi_for_episode >= 0 && static_cast<std::size_t>(digi_for_episode) < name.size() && is_digit(name[digi_for_episode]))
+	{
+		std::size_t pos = digi_for_episode;
+		v.episode = read_number(pos);
+		v.episode_begin = static_cast<std::uint32_t>(digi_for_episode);
+		v.episode_length = static_cast<std::uint32_t>(pos - digi_for_episode);
+		// 05v2
+		if (pos + 1 < name.size() && (name[pos] == 'v' || name[pos] == 'V') && is_digit(name[pos + 1]))
+		{
+			pos++;
+			v.version = static_cast<int>(read_number(pos));
+		}
+	}
+
+	for (std::size_t i = 0; i < name.size(); i++)
+	{
+		if (!is_digit(name[i]) || (i > 0 && is_digit(name[i - 1])))
+			continue;
+
+		auto start = i;
+		auto n = read_number(i);
+		char prev = start > 0 ? name[start - 1] : ' ';
+		char next = i < name.size() ? name[i] : ' ';
+
+		// S01E05
+		if ((prev == 'S' || prev == 's') && (next == 'E' || next == 'e'))
+		{
+			v.season = n;
+			v.season_begin = static_cast<std::uint32_t>(start);
+			v.season_length = static_cast<std::uint32_t>(i - start);
+		}
+		i--;
+	}
+
+	for (auto tag : tags)
+	{
+		for (std::size_t i = tag.begin; i < tag.end(); i++)
+		{
+			if (!is_digit(name[i]) || (i > tag.begin && is_digit(name[i - 1])))
+				continue;
+
+			auto n = read_number(i);
+			char next = i < tag.end() ? name[i] : ' ';
+			// 1080p, 720p, 1080i
+			if ((next == 'p' || next == 'P' || next == 'i' || next == 'I') && n >= 240 && n <= 4320)
+				v.resolution = std::max(v.resolution, static_cast<int>(n));
+			// 4K
+			else if ((next == 'k' || next == 'K') && (n == 4 || n == 8))
+				v.resolution = std::max(v.resolution, static_cast<int>(n * 540));
+			i--;
+		}
+	}
+
+	return v;
+}
+
+// names 是同一部剧 (main.cpp 里的同一个分组) 的各个文件的 base name, 不同的剧要分开去重.
+// tag_spans(i) 是第 i 个文件名里的标签, 分辨率从这里读. file_size(i) 返回第 i 个文件的大小, 只在分辨率和版本号都一样的时候才会调用.
+// 返回去重以后留下的下标, 保持原来的顺序, 每一集出现在它第一个版本所在的位置.
+template<typename Names, typename TagSpans, typename FileSize>
+std::pmr::vector<std::uint32_t> dedupe_best_variant(const Names& names, TagSpans&& tag_spans, int digi_for_episode, FileSize&& file_size, std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+{
+	auto count = static_cast<std::uint32_t>(std::size(names));
+
+	std::pmr::vector<std::uint32_t> kept(mr);
+	std::pmr::vector<episode_variant> kept_variant(mr);
+	open_hash_index episode_index(count, mr);
+
+	auto is_better = [&](std::uint32_t a, const episode_variant& va, std::uint32_t b, const episode_variant& vb)
+	{
+		if (std::tie(va.resolution, va.version) != std::tie(vb.resolution, vb.version))
+			return std::tie(va.resolution, va.version) > std::tie(vb.resolution, vb.version);
+		// 只有分不出高下的时候才看文件大小
+		auto size_a = file_size(a), size_b = file_size(b);
+		if (size_a != size_b)
+			return size_a > size_b;
+		return std::string_view{names[a]} < std::string_view{names[b]};
+	};
+
+	for (std::uint32_t i = 0; i < count; i++)
+	{
+		auto v = parse_episode_variant(names[i], digi_for_episode, tag_spans(i));
+		if (v.episode < 0)
+		{
+			// 解析不出 第几集 的文件没法去重, 原样保留
+			kept.push_back(i);
+			kept_variant.push_back(v);
+			continue;
+		}
+
+		std::uint64_t key[2] = {static_cast<std::uint64_t>(v.season), static_cast<std::uint64_t>(v.episode)};
+		auto slot = static_cast<std::uint32_t>(kept.size());
+		std::uint32_t existing;
+		bool inserted;
+		for (std::uint64_t seed = 0; ; seed++)
+		{
+			std::tie(existing, inserted) = episode_index.try_emplace(hash64(key, sizeof key, seed), slot);
+			if (inserted || (kept_variant[existing].season == v.season && kept_variant[existing].episode == v.episode))
+				break;
+		}
+
+		if (inserted)
+		{
+			kept.push_back(i);
+			kept_variant.push_back(v);
+		}
+		else if (is_better(i, v, kept[existing], kept_variant[existing]))
+		{
+			kept[existing] = i;
+			kept_variant[existing] = v;
+		}
+	}
+
+	return kept;
+}
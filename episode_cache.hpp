@@ -0,0 +1,217 @@
+﻿
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "nowide/fstream.hpp"
+
+#include "hash_util.hpp"
+
+// 第几集 的检测结果缓存.
+// 检测结果只取决于排好序的文件名列表, 所以用文件名列表的 hash 当 key,
+// 文件名没变化的目录, 下次运行就可以完全跳过 find_digi_for_episode.
+//
+// 文件格式: 8 字节 magic, 8 字节检测算法的版本, 然后是一条条定长的 record, 平时只追加不修改.
+// 每条 record 自带校验, 写到一半被打断的 record 读取的时候会被丢弃.
+// 检测算法 (find_digi_for_episode, 以及哪些字符被屏蔽) 一改, 旧的结果就不能用了, 版本对不上的文件整个丢掉.
+//
+// 同一个 key 可以有好几条 record, 以最后一条为准. 这次运行查到的 key 会在 flush 的时候再追加一条,
+// 所以文件里 record 的顺序就是最近一次用到的顺序.
+// 目录里的文件一变, 文件名列表的 hash 就变了, 旧的 record 再也用不上. 所以 record 太多
+// (超过 max_records, 或者超过有效条目的两倍) 的时候压缩一次: 太多的话只留下最近用过的一半,
+// 写到临时文件里再 rename 过去.
+class episode_cache
+{
+	struct record
+	{
+		std::uint64_t names_hash;
+		std::int32_t digi_for_episode;
+		std::uint32_t check;
+	};
+	static_assert(sizeof(record) == 16);
+
+	static constexpr char magic[8] = {'C', 'P', 'L', 'E', 'P', 'I', '0', '2'};
+
+	// 1 MB. 压缩以后留一半, 一万多个目录的树也不会每次运行都压缩
+	static constexpr std::size_t max_records = 1 << 16;
+
+	struct entry
+	{
+		int digi_for_episode;
+		// 越大越新: 读进来的是最后一条 record 在文件里的位置, 这次运行用到的排在所有读进来的后面
+		std::uint64_t last_used;
+	};
+
+	static std::uint32_t record_check(const record& r)
+	{
+		return static_cast<std::uint32_t>(hash64(&r, offsetof(record, check), 0x45504943));
+	}
+
+public:
+	// 改了 find_digi_for_episode 或者屏蔽的规则, 同样的文件名列表会检测出不同的结果, 这时把版本加一
+	static constexpr std::uint64_t algorithm_version = 2;
+
+	episode_cache() = default;
+
+	explicit episode_cache(std::filesystem::path cache_file)
+		: cache_file_(std::move(cache_file))
+	{
+		if (cache_file_.empty())
+			return;
+
+		nowide::ifstream in(cache_file_, std::ios::binary);
+		if (!in)
+			return;
+
+		char file_magic[sizeof magic] = {};
+		std::uint64_t file_version = 0;
+		in.read(file_magic, sizeof file_magic);
+		in.read(reinterpret_cast<char*>(&file_version), sizeof file_version);
+		if (!in || !std::equal(std::begin(magic), std::end(magic), file_magic) || file_version != algorithm_version)
+		{
+			// 不认识的格式, 或者是旧的算法检测出来的, 当作没有缓存, 写的时候重新创建
+			need_rewrite_ = true;
+			return;
+		}
+
+		record r;
+		while (in.read(reinterpret_cast<char*>(&r), sizeof r))
+		{
+			if (r.check == record_check(r))
+				entries_[r.names_hash] = {r.digi_for_episode, clock_};
+			else
+				need_rewrite_ = true;
+			clock_++;
+		}
+		file_records_ = clock_;
+		// 末尾残缺的 record
+		if (in.gcount() != 0)
+			need_rewrite_ = true;
+	}
+
+	episode_cache(episode_cache&&) = default;
+	episode_cache& operator=(episode_cache&&) = default;
+
+	~episode_cache()
+	{
+		flush();
+	}
+
+	std::optional<int> lookup(std::uint64_t names_hash)
+	{
+		auto it = entries_.find(names_hash);
+		if (it == entries_.end())
+			return std::nullopt;
+
+		// 这次运行第一次用到从文件里读出来的结果: 在文件末尾再记一条, 下次读进来的时候它就是新的
+		auto& e = it->second;
+		if (e.last_used < file_records_ && !cache_file_.empty())
+			pending_.push_back(make_record(names_hash, e.digi_for_episode));
+		e.last_used = clock_++;
+		return e.digi_for_episode;
+	}
+
+	void store(std::uint64_t names_hash, int digi_for_episode)
+	{
+		entries_[names_hash] = {digi_for_episode, clock_++};
+		if (!cache_file_.empty())
+			pending_.push_back(make_record(names_hash, digi_for_episode));
+	}
+
+	void flush()
+	{
+		if (cache_file_.empty() || (pending_.empty() && !need_rewrite_))
+			return;
+
+		auto records = file_records_ + pending_.size();
+		if (need_rewrite_ || records > max_records || records > 2 * entries_.size())
+		{
+			// 有损坏的 record, 格式不对, 或者旧的 record 太多: 把内存里的有效内容重写一遍
+			rewrite();
+		}
+		else
+		{
+			bool fresh = !std::filesystem::exists(cache_file_);
+			nowide::ofstream out(cache_file_, std::ios::binary | std::ios::app);
+			if (fresh)
+				write_header(out);
+			out.write(reinterpret_cast<const char*>(pending_.data()), pending_.size() * sizeof(record));
+			file_records_ = records;
+		}
+
+		pending_.clear();
+		need_rewrite_ = false;
+	}
+
+private:
+	void rewrite()
+	{
+		// 按新旧排好, 太多的话只留最新的一半. 写的时候旧的在前, 文件里的顺序还是新旧的顺序
+		std::vector<std::pair<std::uint64_t, const entry*>> by_age;
+		by_age.reserve(entries_.size());
+		for (auto& [names_hash, e] : entries_)
+			by_age.emplace_back(names_hash, &e);
+		std::sort(by_age.begin(), by_age.end(), [](const auto& a, const auto& b) { return a.second->last_used < b.second->last_used; });
+		if (by_age.size() > max_records)
+			by_age.erase(by_age.begin(), by_age.end() - max_records / 2);
+
+		auto tmp_file = cache_file_;
+		tmp_file += ".tmp";
+		{
+			nowide::ofstream out(tmp_file, std::ios::binary | std::ios::trunc);
+			if (!out)
+				return;
+			write_header(out);
+			for (auto [names_hash, e] : by_age)
+			{
+				auto r = make_record(names_hash, e->digi_for_episode);
+				out.write(reinterpret_cast<const char*>(&r), sizeof r);
+			}
+			if (!out.flush())
+			{
+				out.close();
+				std::error_code ec;
+				std::filesystem::remove(tmp_file, ec);
+				return;
+			}
+		}
+
+		std::error_code ec;
+		std::filesystem::rename(tmp_file, cache_file_, ec);
+		if (ec)
+		{
+			std::filesystem::remove(tmp_file, ec);
+			return;
+		}
+		file_records_ = by_age.size();
+	}
+
+	static void write_header(std::ostream& out)
+	{
+		out.write(magic, sizeof magic);
+		out.write(reinterpret_cast<const char*>(&algorithm_version), sizeof algorithm_version);
+	}
+
+	static record make_record(std::uint64_t names_hash, int digi_for_episode)
+	{
+		record r{names_hash, digi_for_episode, 0};
+		r.check = record_check(r);
+		return r;
+	}
+
+	std::filesystem::path cache_file_;
+	std::unordered_map<std::uint64_t, entry> entries_;
+	std::vector<record> pending_;
+	// 文件里现在有多少条 record, 包括损坏的和重复的
+	std::size_t file_records_ = 0;
+	std::uint64_t clock_ = 0;
+	bool need_rewrite_ = false;
+};
@@ -0,0 +1,360 @@
+﻿
+#pragma once
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory_resource>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "generic_string.hpp"
+#include "legacy_encoding.hpp"
+#include "tag_matcher.hpp"
+
+// 一个目录里所有视频文件的表, 整个流水线都围着它转.
+// 按列存放 (struct of arrays), 每个文件是一个行号:
+//   字符串: 所有字符都在同一块 chars_ 里, 每行只记偏移和长度, 放进去以后就不再挪动
+//   路径: 原样的字节, 写进播放列表的就是它
+//   名字: 路径的 NFC 形式, 本来就是 NFC 的 (绝大多数) 和路径共用同一段字符; stem 和扩展名是名字里的片段.
+//         路径不是 UTF-8 的 (GBK/Big5), 名字是转换成 UTF-8 的一份
+//   排序键: 屏蔽了发布标签的名字, 屏蔽后的 stem 就是排序键里同样位置的片段
+//   标签表: stem 里每个发布标签的位置, 去重看分辨率, 显示标题去掉标签都用它
+//   数字段表: 屏蔽后的 stem 里每一段连续数字的位置, 检测 第几集 的时候不用再逐个字符判断
+//   元数据: 文件大小, mtime, 时长, 标志位
+// 排序, 分组, 去重都只是在排列 32 位的行号, 不搬动字符串.
+// 每个字符串后面都跟着一个 '\0', 可以直接交给 strtol 之类的 C 函数.
+class file_table
+{
+public:
+	struct digit_run
+	{
+		std::uint16_t begin;
+		std::uint16_t length;
+	};
+
+	enum flag : std::uint8_t
+	{
+		// file_size 和 mtime_ns 是 stat 出来的
+		has_stat = 1 << 0,
+		// duration 是读视频头读出来的
+		has_media_info = 1 << 1,
+		// 视频头信息来自探测缓存
+		from_cache = 1 << 2,
+		// 路径不是 NFC, 名字是规范化以后另存的一份
+		normalized = 1 << 3,
+		// 路径不是 UTF-8, decode_legacy_names 以后名字是按 GBK/Big5 转换出来的一份
+		legacy_encoding = 1 << 4,
+	};
+
+	explicit file_table(std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+		: file_size(mr)
+		, mtime_ns(mr)
+		, duration(mr)
+		, flags(mr)
+		, chars_(mr)
+		, path_offset_(mr)
+		, path_length_(mr)
+		, name_offset_(mr)
+		, name_length_(mr)
+		, stem_begin_(mr)
+		, stem_length_(mr)
+		, key_offset_(mr)
+		, tag_first_(1, 0, mr)
+		, tags_(mr)
+		, run_first_(1, 0, mr)
+		, runs_(mr)
+		, scratch_(mr)
+	{}
+
+	std::uint32_t size() const { return static_cast<std::uint32_t>(path_offset_.size()); }
+	bool empty() const { return path_offset_.empty(); }
+
+	std::uint32_t add(std::string_view path)
+	{
+		auto row = size();
+		std::uint8_t row_flags = 0;
+		path_offset_.push_back(append_chars(path));
+		path_length_.push_back(static_cast<std::uint32_t>(path.size()));
+
+		// 不是 UTF-8 的先原样当作名字, 等 decode_legacy_names 看过整个目录再转换
+		if (!utf8::validate(path.data(), path.size()))
+			row_flags |= legacy_encoding;
+
+		// 排序和检测都用 NFC 形式, 否则从 Mac 拷过来的 NFD 文件名和别的文件排不到一起
+		auto nfc_name = to_nfc(path, scratch_);
+		if (nfc_name.data() == path.data())
+		{
+			name_offset_.push_back(path_offset_.back());
+		}
+		else
+		{
+			name_offset_.push_back(append_chars(nfc_name));
+			row_flags |= normalized;
+		}
+		name_length_.push_back(static_cast<std::uint32_t>(nfc_name.size()));
+
+		auto [stem_begin, stem_length] = stem_span(name(row));
+		stem_begin_.push_back(stem_begin);
+		stem_length_.push_back(stem_length);
+
+		file_size.push_back(0);
+		mtime_ns.push_back(0);
+		duration.push_back(-1);
+		flags.push_back(row_flags);
+		return row;
+	}
+
+	std::string_view path(std::uint32_t row) const
+	{
+		return {chars_.data() + path_offset_[row], path_length_[row]};
+	}
+
+	// 路径的 NFC 形式, 或者转换成 UTF-8 的 GBK/Big5 路径
+	std::string_view name(std::uint32_t row) const
+	{
+		return {chars_.data() + name_offset_[row], name_length_[row]};
+	}
+
+	std::string_view stem(std::uint32_t row) const
+	{
+		return name(row).substr(stem_begin_[row], stem_length_[row]);
+	}
+
+	std::string_view extension(std::uint32_t row) const
+	{
+		return name(row).substr(stem_begin_[row] + stem_length_[row]);
+	}
+
+	// 终端上显示的路径. NFD 的路径显示出来和 NFC 的一样, 原样显示; GBK/Big5 的原样显示是乱码, 显示转换以后的名字
+	std::string_view display_path(std::uint32_t row) const
+	{
+		return flags[row] & legacy_encoding ? name(row) : path(row);
+	}
+
+	// stem 里 pos 处的数字在 display_path 里的位置.
+	// NFC 只会合并字母和附加符号, 数字不受影响, 所以数到第几个数字就能对上
+	std::uint32_t display_position_of_digit(std::uint32_t row, std::uint32_t pos) const
+	{
+		auto s = stem(row);
+		if (!(flags[row] & normalized) || (flags[row] & legacy_encoding))
+			return stem_begin_[row] + pos;
+
+		auto digits_before = std::count_if(s.begin(), s.begin() + std::min<std::size_t>(pos, s.size()), is_digit);
+		auto p = path(row);
+		auto begin = stem_span(p).first;
+		for (auto i = begin; i < p.size(); i++)
+		{
+			if (is_digit(p[i]) && digits_before-- == 0)
+				return static_cast<std::uint32_t>(i);
+		}
+		return static_cast<std::uint32_t>(p.size());
+	}
+
+	// 不是 UTF-8 的路径 (老的 Windows 压缩包解出来的 GBK/Big5 文件名) 放在一起判断是哪种编码, 把名字转换成 UTF-8.
+	// 路径还是原来的字节, 不然播放器打不开. 两种编码都解不了的, 名字还是原来的字节.
+	// 所有文件都加进来以后, build_keys 之前调用
+	void decode_legacy_names()
+	{
+		auto count = size();
+		legacy::detector detector;
+		bool any = false;
+		for (std::uint32_t row = 0; row < count; row++)
+		{
+			if (flags[row] & legacy_encoding)
+			{
+				detector.add(path(row));
+				any = true;
+			}
+		}
+		if (!any)
+			return;
+
+		auto best = detector.best();
+		auto other = best == legacy::encoding::gbk ? legacy::encoding::big5 : legacy::encoding::gbk;
+		for (std::uint32_t row = 0; row < count; row++)
+		{
+			if (!(flags[row] & legacy_encoding))
+				continue;
+			auto p = path(row);
+			if (!legacy::to_utf8(best, p, scratch_) && !legacy::to_utf8(other, p, scratch_))
+				continue;
+
+			name_offset_[row] = append_chars(scratch_);
+			name_length_[row] = static_cast<std::uint32_t>(scratch_.size());
+			std::tie(stem_begin_[row], stem_length_[row]) = stem_span(scratch_);
+		}
+	}
+
+	// build_keys 以后才有
+	std::string_view sort_key(std::uint32_t row) const
+	{
+		return {chars_.data() + key_offset_[row], name_length_[row]};
+	}
+
+	std::string_view masked_stem(std::uint32_t row) const
+	{
+		return sort_key(row).substr(stem_begin_[row], stem_length_[row]);
+	}
+
+	// 相对 stem 的开头
+	std::span<const tag_matcher::span> tag_spans(std::uint32_t row) const
+	{
+		return std::span{tags_}.subspan(tag_first_[row], tag_first_[row + 1] - tag_first_[row]);
+	}
+
+	std::span<const digit_run> digit_runs(std::uint32_t row) const
+	{
+		return std::span{runs_}.subspan(run_first_[row], run_first_[row + 1] - run_first_[row]);
+	}
+
+	// 所有文件都加进来以后调用一次: 生成排序键, 标签表和数字段表
+	void build_keys(const tag_matcher& tags)
+	{
+		auto count = size();
+
+		// 排序键和名字一样长, 先把空间留够, 生成的过程中 chars_ 不能搬家
+		std::size_t key_chars = 0;
+		for (auto length : name_length_)
+			key_chars += length + 1;
+		chars_.reserve(chars_.size() + key_chars);
+		key_offset_.resize(count);
+		for (std::uint32_t row = 0; row < count; row++)
+		{
+			auto n = name(row);
+			key_offset_[row] = static_cast<std::uint32_t>(chars_.size());
+			chars_.insert(chars_.end(), n.begin(), n.end());
+			chars_.push_back('\0');
+		}
+
+		tags_.clear();
+		tag_first_.assign(1, 0);
+		auto names = std::views::iota(std::uint32_t{0}, count) | std::views::transform([this](std::uint32_t row) { return name(row); });
+		tags.scan_all(names, [&](std::size_t row, const std::pmr::vector<tag_matcher::span>& spans)
+		{
+			auto key = chars_.data() + key_offset_[row];
+			auto stem_begin = stem_begin_[row], stem_end = stem_begin_[row] + stem_length_[row];
+			for (auto s : spans)
+			{
+				std::fill_n(key + s.begin, s.length, tag_matcher::mask_char);
+				auto begin = std::max(s.begin, stem_begin), end = std::min(s.end(), stem_end);
+				if (begin < end)
+					tags_.push_back({begin - stem_begin, end - begin});
+			}
+			tag_first_.push_back(static_cast<std::uint32_t>(tags_.size()));
+		}, chars_.get_allocator().resource());
+
+		runs_.clear();
+		run_first_.assign(1, 0);
+		for (std::uint32_t row = 0; row < count; row++)
+		{
+			auto name = masked_stem(row);
+			for (std::size_t i = 0; i < name.size(); )
+			{
+				if (!is_digit(name[i]))
+				{
+					i++;
+					continue;
+				}
+				auto begin = i;
+				while (i < name.size() && is_digit(name[i]))
+					i++;
+				runs_.push_back({static_cast<std::uint16_t>(begin), static_cast<std::uint16_t>(i - begin)});
+			}
+			run_first_.push_back(static_cast<std::uint32_t>(runs_.size()));
+		}
+	}
+
+	static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+	// 还没 stat 过就 stat 一次, 填上 file_size 和 mtime_ns. stat 失败返回 false, 两列保持 0
+	bool ensure_stat(std::uint32_t row)
+	{
+		if (flags[row] & has_stat)
+			return true;
+
+#ifdef _WIN32
+		std::error_code ec;
+		std::filesystem::path file(std::u8string_view{reinterpret_cast<const char8_t*>(path(row).data()), path(row).size()});
+		auto size = std::filesystem::file_size(file, ec);
+		if (ec)
+			return false;
+		auto mtime = std::filesystem::last_write_time(file, ec);
+		if (ec)
+			return false;
+		file_size[row] = size;
+		mtime_ns[row] = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+#else
+		// 路径后面有 '\0', 可以直接交给 stat
+		struct stat st;
+		if (::stat(path(row).data(), &st) != 0)
+			return false;
+		file_size[row] = static_cast<std::uint64_t>(st.st_size);
+		mtime_ns[row] = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+		flags[row] |= has_stat;
+		return true;
+	}
+
+	// 元数据列, 按行号下标
+	std::pmr::vector<std::uint64_t> file_size;
+	std::pmr::vector<std::int64_t> mtime_ns;
+	// 秒, 小于 0 表示不知道
+	std::pmr::vector<double> duration;
+	std::pmr::vector<std::uint8_t> flags;
+
+private:
+	// 和 std::filesystem::path::stem 一致: 最后一个分隔符之后, 最后一个 '.' 之前, 以 '.' 开头的不算扩展名
+	static std::pair<std::uint32_t, std::uint32_t> stem_span(std::string_view path)
+	{
+#ifdef _WIN32
+		auto separator = path.find_last_of("/\\");
+#else
+		auto separator = path.rfind('/');
+#endif
+		auto name_begin = separator == std::string_view::npos ? 0 : separator + 1;
+		auto file_name = path.substr(name_begin);
+		auto dot = file_name.rfind('.');
+		auto stem_length = dot == std::string_view::npos || dot == 0 || file_name == ".." ? file_name.size() : dot;
+		return {static_cast<std::uint32_t>(name_begin), static_cast<std::uint32_t>(stem_length)};
+	}
+
+	// 追加一个以 '\0' 结尾的字符串, 返回偏移
+	std::uint32_t append_chars(std::string_view str)
+	{
+		auto offset = static_cast<std::uint32_t>(chars_.size());
+		chars_.insert(chars_.end(), str.begin(), str.end());
+		chars_.push_back('\0');
+		return offset;
+	}
+
+	std::pmr::vector<char> chars_;
+	std::pmr::vector<std::uint32_t> path_offset_;
+	std::pmr::vector<std::uint32_t> path_length_;
+	std::pmr::vector<std::uint32_t> name_offset_;
+	std::pmr::vector<std::uint32_t> name_length_;
+	// 相对名字开头
+	std::pmr::vector<std::uint32_t> stem_begin_;
+	std::pmr::vector<std::uint32_t> stem_length_;
+	std::pmr::vector<std::uint32_t> key_offset_;
+	// 第 row 行的标签是 tags_[tag_first_[row], tag_first_[row + 1])
+	std::pmr::vector<std::uint32_t> tag_first_;
+	std::pmr::vector<tag_matcher::span> tags_;
+	// 第 row 行的数字段是 runs_[run_first_[row], run_first_[row + 1])
+	std::pmr::vector<std::uint32_t> run_first_;
+	std::pmr::vector<digit_run> runs_;
+	// 规范化和转换编码用的临时缓冲区
+	std::pmr::string scratch_;
+};
@@ -6,10 +6,15 @@
 #endif
 
 #include <cstdint>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <climits>
 
+#include "unicode_nfc.hpp"
+#include "utf8_codec.hpp"
+
 template<template< typename > typename Allocator = std::pmr::polymorphic_allocator>
 struct basic_generic_string
 {
@@ -204,182 +209,29 @@ struct basic_generic_string
 
 #if WCHAR_MAX >= INT32_MAX
 	// convert ucs to utf8
+	// 先算好确切的长度, 从 alloc 一次分配, 再整块编码. 只输出合法的 UTF-8, 详见 utf8_codec.hpp
 	template <typename STRING_TYPE = u8string>
-	static STRING_TYPE to_utf8(std::wstring_view wstr, Allocator<typename STRING_TYPE::value_type> alloc = {})
+	static STRING_TYPE to_utf8(std::wstring_view wstr, Allocator<typename STRING_TYPE::value_type> alloc = {}, utf8::invalid_code_point policy = utf8::invalid_code_point::replace)
 	{
 		using CHAR = typename STRING_TYPE::value_type;
 		STRING_TYPE ret{alloc};
-		ret.reserve(wstr.size()*6);
-
-		for (wchar_t C : wstr)
+		auto size = utf8::encoded_length(wstr.data(), wstr.size(), policy);
+		ret.resize_and_overwrite(size, [&](CHAR* out, std::size_t)
 		{
-			if (C <= 0b01111111)
-			{
-				ret.push_back(static_cast<CHAR>(C));
-			}
-			else if (C <= 0b11111111111) // two byte encoding
-			{
-				ret.push_back(
-					static_cast<CHAR>((C >> 6) | 0b11000000)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>(C & 0b111111 | 0b10000000)
-				);
-			}
-			else if (C <= 0b1111111111111111) // 3 byte encoding
-			{
-				ret.push_back(
-					static_cast<CHAR>((C >> 12) | 0b11100000)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>( (C>>6) & 0b111111 | 0b10000000)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>( (C) & 0b111111 | 0b10000000)
-				);
-			}
-			else if (C <= 0b111111111111111111111) // 4 byte encoding
-			{
-				ret.push_back(
-					static_cast<CHAR>((C >> 18) | 0b11110000)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>( (C>>12) & 0b111111 | 0b10000000)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>( (C>>6) & 0b111111 | 0b10000000)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>( (C) & 0b111111 | 0b10000000)
-				);
-			}
-			else if (C <= 0b11111111111111111111111111) // 5 byte encoding
-			{
-				ret.push_back(
-					static_cast<CHAR>((C >> 24) | 0b11111000)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>( (C>>18) & 0b111111 | 0b10000000)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>( (C>>12) & 0b111111 | 0b10000000)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>( (C>>6) & 0b111111 | 0b10000000)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>( (C) & 0b111111 | 0b10000000)
-				);
-			}
-			else if (C <= 0b1111111111111111111111111111111) // 6 byte encoding
-			{
-				ret.push_back(
-					static_cast<CHAR>((C >> 30) | 0b11111100)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>( (C>>24) & 0b111111 | 0b10000000)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>( (C>>18) & 0b111111 | 0b10000000)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>( (C>>12) & 0b111111 | 0b10000000)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>( (C>>6) & 0b111111 | 0b10000000)
-				);
-
-				ret.push_back(
-					static_cast<CHAR>( (C) & 0b111111 | 0b10000000)
-				);
-			}
-		}
-
+			return utf8::encode(wstr.data(), wstr.size(), reinterpret_cast<char*>(out), policy);
+		});
 		return ret;
 	}
 
+	// 校验着解码, 不合法的字节换成 U+FFFD, 详见 utf8_codec.hpp
 	template <typename STRING_TYPE = std::u8string_view>
-	static wstring from_utf8(STRING_TYPE utf8_str, Allocator<wchar_t> alloc = {})
+	static wstring from_utf8(const STRING_TYPE& utf8_str, Allocator<wchar_t> alloc = {})
 	{
 		wstring ret{alloc};
-		ret.reserve(utf8_str.size());
-
-		for (auto p = utf8_str.begin(); p != utf8_str.end(); p++)
-		{
-			unsigned char c = *p;
-			if (c <= 0b01111111)
-			{
-				ret.push_back(static_cast<wchar_t>(c));
-			}
-			else if ( c <= 0b11011111 )
-			{
-				p++;
-				unsigned char c2 = *p;
-				ret.push_back(static_cast<wchar_t>( ((c&0b11111) << 6) + (c2 & 0b111111)));
-			}
-			else if ( c <= 0b11101111 )
-			{
-				p++;
-				unsigned char c2 = *p;
-				p++;
-				unsigned char c3 = *p;
-				ret.push_back(static_cast<wchar_t>( ((c&0b1111) << 12) + ((c2 & 0b111111)<< 6) + (c3 &0b111111)));
-			}
-			else if ( c <= 0b11110111 )
-			{
-				p++;
-				unsigned char c2 = *p;
-				p++;
-				unsigned char c3 = *p;
-				p++;
-				unsigned char c4 = *p;
-				ret.push_back(static_cast<wchar_t>( ((c&0b111) << 18) + ((c2 & 0b111111)<< 12) + ((c3 &0b111111)<<6) + (c4&0b111111)));
-			}
-			else if ( c <= 0b11111011 )
-			{
-				p++;
-				unsigned char c2 = *p;
-				p++;
-				unsigned char c3 = *p;
-				p++;
-				unsigned char c4 = *p;
-				p++;
-				unsigned char c5 = *p;
-				ret.push_back(static_cast<wchar_t>( ((c&0b11) << 24) + ((c2 & 0b111111)<< 18) + ((c3 &0b111111)<<12) + ((c4&0b111111)<<6) + (c5&0b111111)));
-			}
-			else if ( c <= 0b11111101 )
-			{
-				p++;
-				unsigned char c2 = *p;
-				p++;
-				unsigned char c3 = *p;
-				p++;
-				unsigned char c4 = *p;
-				p++;
-				unsigned char c5 = *p;
-				p++;
-				unsigned char c6 = *p;
-				ret.push_back(static_cast<wchar_t>( ((c&0b1) << 30) + ((c2 & 0b111111)<< 24) + ((c3 &0b111111)<<18) + ((c4&0b111111)<<12) + ((c5&0b111111)<<6) + (c6&0b111111)));
-			}
-			else
-			{
-				continue;
-			}
-		}
+		auto bytes = reinterpret_cast<const char*>(std::data(utf8_str));
+		auto size = std::size(utf8_str);
+		// 码点数不会超过字节数
+		ret.resize_and_overwrite(size, [&](wchar_t* out, std::size_t) { return utf8::decode(bytes, size, out); });
 		return ret;
 	}
 #endif
@@ -388,3 +240,12 @@ struct basic_generic_string
 using generic_string = basic_generic_string<std::allocator>;
 
 using pmr_generic_string = basic_generic_string<std::pmr::polymorphic_allocator>;
+
+// 文件名的 NFC 形式, 排序和检测用它, 写进播放列表的还是原来的字节.
+// 本来就是 NFC 的 (绝大多数文件名) 原样返回 name, 不拷贝; 否则规范化到 scratch 里, 返回的是 scratch
+inline std::string_view to_nfc(std::string_view name, std::pmr::string& scratch)
+{
+	if (nfc::normalize(name, scratch))
+		return name;
+	return scratch;
+}
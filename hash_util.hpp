@@ -0,0 +1,144 @@
+﻿
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// 64 位快速 hash. 结果会被写入缓存文件, 所以算法一旦确定就不能再改.
+// 一次吃 8 个字节, 最后用 splitmix64 的 finalizer 做雪崩.
+inline std::uint64_t hash64(const void* data, std::size_t len, std::uint64_t seed = 0)
+{
+	constexpr std::uint64_t k0 = 0x9E3779B97F4A7C15ull;
+	constexpr std::uint64_t k1 = 0xBF58476D1CE4E5B9ull;
+	constexpr std::uint64_t k2 = 0x94D049BB133111EBull;
+
+	auto p = static_cast<const unsigned char*>(data);
+	std::uint64_t h = seed ^ (len * k0);
+
+	auto rotl = [](std::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+
+	while (len >= 8)
+	{
+		std::uint64_t w;
+		std::memcpy(&w, p, 8);
+		h ^= rotl(w * k1, 31) * k2;
+		h = rotl(h, 27) * k0 + 0x52DCE729;
+		p += 8;
+		len -= 8;
+	}
+
+	if (len)
+	{
+		std::uint64_t w = 0;
+		std::memcpy(&w, p, len);
+		h ^= rotl(w * k1, 31) * k2;
+	}
+
+	h ^= h >> 30;
+	h *= k1;
+	h ^= h >> 27;
+	h *= k2;
+	h ^= h >> 31;
+	return h;
+}
+
+inline std::uint64_t hash64(std::string_view str, std::uint64_t seed = 0)
+{
+	return hash64(str.data(), str.size(), seed);
+}
+
+// 对一串字符串整体求 hash, 每个元素的长度也参与运算, 所以 {"ab","c"} 和 {"a","bc"} 不会撞车
+template<typename Container>
+std::uint64_t hash64_list(const Container& list, std::uint64_t seed = 0)
+{
+	std::uint64_t h = seed;
+	for (const auto& s : list)
+	{
+		h = hash64(std::string_view{s}, h);
+	}
+	return h;
+}
+
+// 开放寻址 (线性探测) 的 hash 表, 把 64 位 hash 映射成一个 32 位的编号.
+// 只插入不删除, 专门给 "按 hash 分组" 这种一遍扫描的场景用.
+class open_hash_index
+{
+	struct slot
+	{
+		std::uint64_t key;
+		std::uint32_t value;
+	};
+
+	static constexpr std::uint32_t empty_value = UINT32_MAX;
+
+public:
+	explicit open_hash_index(std::size_t expected_size = 16, std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+		: slots_(mr)
+	{
+		std::size_t capacity = 16;
+		while (capacity < expected_size * 2)
+			capacity <<= 1;
+		slots_.assign(capacity, slot{0, empty_value});
+	}
+
+	// 如果 key 已经存在, 返回已有的编号和 false
+	// 否则插入 value, 返回 value 和 true
+	std::pair<std::uint32_t, bool> try_emplace(std::uint64_t key, std::uint32_t value)
+	{
+		if ((size_ + 1) * 2 > slots_.size())
+			grow();
+
+		auto mask = slots_.size() - 1;
+		for (auto i = key & mask; ; i = (i + 1) & mask)
+		{
+			if (slots_[i].value == empty_value)
+			{
+				slots_[i] = slot{key, value};
+				size_++;
+				return {value, true};
+			}
+			if (slots_[i].key == key)
+				return {slots_[i].value, false};
+		}
+	}
+
+	std::optional<std::uint32_t> find(std::uint64_t key) const
+	{
+		auto mask = slots_.size() - 1;
+		for (auto i = key & mask; ; i = (i + 1) & mask)
+		{
+			if (slots_[i].value == empty_value)
+				return std::nullopt;
+			if (slots_[i].key == key)
+				return slots_[i].value;
+		}
+	}
+
+	std::size_t size() const { return size_; }
+
+private:
+	void grow()
+	{
+		std::pmr::vector<slot> old(slots_.size() * 2, slot{0, empty_value}, slots_.get_allocator());
+		old.swap(slots_);
+		auto mask = slots_.size() - 1;
+		for (auto& s : old)
+		{
+			if (s.value == empty_value)
+				continue;
+			auto i = s.key & mask;
+			while (slots_[i].value != empty_value)
+				i = (i + 1) & mask;
+			slots_[i] = s;
+		}
+	}
+
+	std::pmr::vector<slot> slots_;
+	std::size_t size_ = 0;
+};
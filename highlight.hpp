@@ -0,0 +1,90 @@
+﻿
+#pragma once
+
+#include <cstdint>
+#include <memory_resource>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "playlist_writer.hpp"
+
+// 终端上显示文件名的时候要上色的片段 (第几季, 第几集).
+// 片段的位置在建文件表的时候就算好了, 渲染的时候不再解析文件名:
+// 每个片段就是 前缀, 颜色 + 片段 + 复位 的几次整段拷贝, 最后再拷贝剩下的后缀.
+enum class highlight_role : std::uint8_t
+{
+	season,
+	episode,
+};
+
+struct highlight_span
+{
+	std::uint32_t begin;
+	std::uint32_t length;
+	highlight_role role;
+};
+
+// 按 highlight_role 的顺序
+inline constexpr std::string_view highlight_colour[] = {
+	"\033[0;36m\033[1m",
+	"\033[0;35m\033[1m",
+};
+inline constexpr std::string_view highlight_reset = "\033[0m";
+
+// 所有文件的高亮片段放在一个数组里, 第 i 个文件的是 spans[first[i], first[i + 1])
+class highlight_table
+{
+public:
+	explicit highlight_table(std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+		: spans_(mr)
+		, first_(1, 0, mr)
+	{}
+
+	// 按顺序给下一个文件加片段, 每个文件加完以后调用 next_file
+	void add(std::uint32_t begin, std::uint32_t length, highlight_role role)
+	{
+		if (length != 0)
+			spans_.push_back({begin, length, role});
+	}
+
+	void next_file()
+	{
+		// 同一个文件的片段按位置排好, 最多也就两三个
+		auto file_spans = std::span{spans_}.subspan(first_.back());
+		for (std::size_t i = 1; i < file_spans.size(); i++)
+		{
+			for (auto j = i; j > 0 && file_spans[j].begin < file_spans[j - 1].begin; j--)
+				std::swap(file_spans[j], file_spans[j - 1]);
+		}
+		first_.push_back(static_cast<std::uint32_t>(spans_.size()));
+	}
+
+	std::span<const highlight_span> operator[](std::size_t file) const
+	{
+		return std::span{spans_}.subspan(first_[file], first_[file + 1] - first_[file]);
+	}
+
+private:
+	std::pmr::vector<highlight_span> spans_;
+	std::pmr::vector<std::uint32_t> first_;
+};
+
+// spans 按位置排好序; 和前一个重叠或者超出 text 的片段不上色
+inline void render_highlighted(render_buffer& buf, std::string_view text, std::span<const highlight_span> spans)
+{
+	std::size_t pos = 0;
+	for (const auto& s : spans)
+	{
+		if (s.begin < pos || s.begin + std::size_t{s.length} > text.size())
+			continue;
+
+		buf.append(text.substr(pos, s.begin - pos));
+		buf.append(highlight_colour[static_cast<std::size_t>(s.role)]);
+		buf.append(text.substr(s.begin, s.length));
+		buf.append(highlight_reset);
+		pos = s.begin + s.length;
+	}
+	buf.append(text.substr(pos));
+}
@@ -0,0 +1,132 @@
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+#include "legacy_encoding_tables.hpp"
+#include "utf8_codec.hpp"
+
+// 老的 Windows 压缩包在 Linux 上解出来, 文件名是 GBK (简体) 或者 Big5 (繁体) 的字节, 不是 UTF-8,
+// 排序排得乱七八糟, 终端上显示也是乱码.
+//
+// 先用 utf8::validate 把合法的 UTF-8 (绝大多数文件名) 排除掉, 剩下的按两种编码各解一遍, 给解出来的字打分:
+// 文件名里常见的字分最高, 一级字, 二级字依次低一点, 生僻字, 制表符, 自定义区之类的扣分, 解不出来的扣得最多.
+// 同一个目录里的文件名一般来自同一个压缩包, 分数加在一起再决定是哪种编码.
+// 转换只是查 legacy_encoding_tables.hpp 里的表, 不依赖 iconv.
+namespace legacy
+{
+	enum class encoding : std::uint8_t
+	{
+		gbk,
+		big5,
+	};
+
+	// 按 encoding 的顺序
+	inline constexpr std::string_view encoding_name[] = {"GBK", "Big5"};
+
+	// 一个双字节字符的码点, 0 表示这种编码里没有这个字符
+	inline char16_t lookup(encoding e, unsigned lead, unsigned trail)
+	{
+		using namespace tables;
+		if (trail < trail_first || trail - trail_first >= trail_count)
+			return 0;
+		if (e == encoding::gbk)
+		{
+			if (lead < gbk_lead_first || lead > gbk_lead_last)
+				return 0;
+			return gbk_to_unicode[(lead - gbk_lead_first) * trail_count + trail - trail_first];
+		}
+		if (lead < big5_lead_first || lead > big5_lead_last)
+			return 0;
+		return big5_to_unicode[(lead - big5_lead_first) * trail_count + trail - trail_first];
+	}
+
+	// 按 e 逐个字符解码, 每个码点调用一次 on_char. 碰到这种编码里没有的序列返回 false
+	template<typename Callback>
+	bool decode(encoding e, std::string_view bytes, Callback&& on_char)
+	{
+		for (std::size_t i = 0; i < bytes.size();)
+		{
+			auto lead = static_cast<unsigned char>(bytes[i]);
+			if (lead < 0x80)
+			{
+				on_char(char32_t{lead});
+				i++;
+				continue;
+			}
+
+			if (i + 1 == bytes.size())
+				return false;
+			auto cp = lookup(e, lead, static_cast<unsigned char>(bytes[i + 1]));
+			if (cp == 0)
+				return false;
+			on_char(char32_t{cp});
+			i += 2;
+		}
+		return true;
+	}
+
+	// 一个字出现在文件名里有多像样
+	inline int char_score(char32_t cp)
+	{
+		if (cp < 0x80)
+			return 0;
+		if (cp >= tables::hanzi_first && cp <= tables::hanzi_last)
+		{
+			constexpr int weight[] = {-2, 1, 2, 3};
+			auto i = cp - tables::hanzi_first;
+			return weight[tables::hanzi_class[i / 32] >> (i % 32 * 2) & 3];
+		}
+		// 全角标点, 【】「」 之类
+		if ((cp >= 0x3000 && cp < 0x3040) || (cp >= 0xFF00 && cp < 0xFFF0))
+			return 1;
+		// 假名, 希腊字母, 西里尔字母: 日文片名里会有, 不加分也不扣分
+		if ((cp >= 0x0370 && cp < 0x0530) || (cp >= 0x3040 && cp < 0x3100))
+			return 0;
+		// 制表符, 自定义区, 扩展区的生僻字, 正常的文件名里不会有
+		return -2;
+	}
+
+	// 把一个目录里不是 UTF-8 的文件名一个个加进来, 最后看哪种编码的总分高
+	class detector
+	{
+	public:
+		void add(std::string_view name)
+		{
+			for (auto e : {encoding::gbk, encoding::big5})
+			{
+				int score = 0;
+				auto ok = decode(e, name, [&score](char32_t cp) { score += char_score(cp); });
+				// 解不出来的扣的分比任何能解出来的都多
+				scores_[static_cast<std::size_t>(e)] += ok ? score : -4 * static_cast<int>(name.size());
+			}
+		}
+
+		// 分数一样的时候选 GBK, 简体的压缩包更常见
+		encoding best() const
+		{
+			return scores_[1] > scores_[0] ? encoding::big5 : encoding::gbk;
+		}
+
+	private:
+		int scores_[2] = {};
+	};
+
+	// 按 e 转成 UTF-8 放进 out. 碰到这种编码里没有的序列返回 false, 这时 out 的内容不确定
+	inline bool to_utf8(encoding e, std::string_view bytes, std::pmr::string& out)
+	{
+		bool ok = true;
+		// 单字节的原样, 双字节的字符编码以后最多 3 个字节
+		out.resize_and_overwrite(bytes.size() / 2 * 3 + 1, [&](char* buf, std::size_t)
+		{
+			auto end = buf;
+			ok = decode(e, bytes, [&end](char32_t cp) { end = utf8::encode_one(cp, end, utf8::invalid_code_point::replace); });
+			return ok ? static_cast<std::size_t>(end - buf) : 0;
+		});
+		return ok;
+	}
+}
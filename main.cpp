@@ -15,128 +15,111 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <map>
+#include <span>
 #include <string>
 #include <vector>
 #include <memory_resource>
-#include <list>
 #include <deque>
 #include <glob.h>
+#include <charconv>
+#include <csignal>
+#include <ranges>
 
 #include "nowide/iostream.hpp"
 #include "nowide/args.hpp"
 
 #include "container_util.hpp"
 #include "generic_string.hpp"
+#include "hash_util.hpp"
+#include "cache_dir.hpp"
+#include "episode_cache.hpp"
+#include "string_pool.hpp"
+#include "series_cluster.hpp"
+#include "dedupe.hpp"
+#include "tag_matcher.hpp"
+#include "playlist_writer.hpp"
+#include "highlight.hpp"
+#include "file_table.hpp"
+#include "output_sink.hpp"
+#include "playlist_format.hpp"
+#include "media_probe.hpp"
+#include "cancellation.hpp"
+#include "probe_cache.hpp"
+#include "probe_pool.hpp"
 
 #include "raii_util.hpp"
+#include "run_arena.hpp"
+#include "counting_resource.hpp"
 
 #ifdef _WIN32
 #define isatty _isatty
 #endif
 
-struct GC : public std::pmr::memory_resource
-{
-    virtual void* do_allocate(size_t __bytes, size_t __alignment) override
-	{
-		return std::malloc(__bytes);
-	}
-
-    virtual void  do_deallocate(void* __p, size_t __bytes, size_t __alignment) override {}
-
-    virtual bool do_is_equal(const memory_resource& __other) const noexcept override  { return true ;}
-};
-
-// element_type 可以是 std::string, std::filesystem::path, boost::filesystem::path
-template<typename element_type = std::filesystem::path>
-static auto glob(auto pattern)
+// 列举匹配 pattern 的文件, 直接加进文件表
+static void glob_into(file_table& table, const std::string& pattern)
 {
 	glob_t glob_result;
-	::glob(reinterpret_cast<const char*>(pattern.c_str()), GLOB_ERR | GLOB_MARK | GLOB_NOSORT | GLOB_NOESCAPE, nullptr, &glob_result);
+	::glob(pattern.c_str(), GLOB_ERR | GLOB_MARK | GLOB_NOSORT | GLOB_NOESCAPE, nullptr, &glob_result);
 	fn_unique_ptr<glob_t,globfree> auto_free_glob(&glob_result);
 
-	return map<std::vector>(as_container(glob_result.gl_pathv, glob_result.gl_pathc), [](const auto& gl_path)
-	{
-		return element_type{std::string_view{gl_path}};
-	});
+	for (auto gl_path : as_container(glob_result.gl_pathv, glob_result.gl_pathc))
+		table.add(gl_path);
 }
 
-template<template<typename...> typename  Container = std::vector, typename Allocator = std::allocator<int>>
-Container<int> find_digi_for_two_string(std::string_view a, std::string_view b, Allocator alloc)
-{
-	Container<int> ret(alloc);
-
-	for (auto i = 0; (i < a.size()) && (i < b.size()); i++)
-	{
-		if (std::isdigit(a[i]) && std::isdigit(b[i]))
-		{
-			char* remain = nullptr;
-			auto episode_a = std::strtol(&(a[i]), &remain, 10);
-			ret.push_back(i);
-			if (a[i] != b[i])
-			{
-				ret.push_back(i);
-			}
-			if (remain)
-			{
-				i = remain - a.data() - 1;
-			}
-		}
-	}
-	return ret;
-}
-
-template<ContainerType Container>
-auto find_digi_for_episode(Container&& list)
+// 检测结果会缓存在 episode_cache 里, 改了这里的算法要把 episode_cache::algorithm_version 加一
+static int find_digi_for_episode(const file_table& table, std::span<const std::uint32_t> rows, std::pmr::memory_resource* mr)
 {
 	// 其实就是输出第几个 数字序列，表示 第几集 的意思.
-	auto list_size = std::distance(std::begin(list), std::end(list));
-	if (list_size < 2)
+	if (rows.size() < 2)
 	{
 		return 0;
 	}
 
-	std::pmr::monotonic_buffer_resource mbr;
-
-	std::pmr::list<int> diff_idx_array(&mbr);
-
 	// 方法就是查找文件名的差异部分的最大值
-	// 进行 两两 比对
-	for (int a = 0; a < list_size; a++)
+	// 进行 两两 比对: a 的每一段数字里, 第一个 b 在同样位置也是数字的下标记一次, 两边数字不同的再多记一次.
+	// 用的是文件表里现成的数字段, 每个下标出现了多少次直接累加在按下标排的数组里
+	std::pmr::vector<int> idx_occurrences(mr);
+	for (auto a : rows)
 	{
-		for (int b = 0; b < list_size; b++)
+		auto name_a = table.masked_stem(a);
+		auto runs_a = table.digit_runs(a);
+		if (runs_a.empty())
+			continue;
+		if (idx_occurrences.size() < name_a.size())
+			idx_occurrences.resize(name_a.size(), 0);
+
+		for (auto b : rows)
 		{
-			if (a != b)
-			{
-				auto list_iter_a = std::begin(list);
-				auto list_iter_b = std::begin(list);
-				std::advance(list_iter_a, a);
-				std::advance(list_iter_b, b);
-
-				const auto& file1 = *list_iter_a;
-				const auto& file2 = *list_iter_b;
+			if (a == b)
+				continue;
 
-				auto diff_idx = find_digi_for_two_string<std::pmr::list>(file1, file2, &mbr);
-
-				diff_idx_array.splice(diff_idx_array.end(), std::move(diff_idx));
+			auto name_b = table.masked_stem(b);
+			auto common_len = std::min(name_a.size(), name_b.size());
+			for (auto run : runs_a)
+			{
+				std::size_t end = std::min<std::size_t>(run.begin + run.length, common_len);
+				for (std::size_t i = run.begin; i < end; i++)
+				{
+					if (file_table::is_digit(name_b[i]))
+					{
+						idx_occurrences[i] += name_a[i] != name_b[i] ? 2 : 1;
+						break;
+					}
+				}
 			}
 		}
 	}
 
-	std::pmr::map<int, int> idx_count_map(&mbr);
-
 	// 统计下标和次数
-
-	for (auto diff_idx : diff_idx_array)
+	std::pmr::vector<std::pair<int, int>> idx_counts(mr);
+	for (std::size_t i = 0; i < idx_occurrences.size(); i++)
 	{
-		idx_count_map[diff_idx] += idx_count_map.count(diff_idx);
+		if (idx_occurrences[i] != 0)
+			idx_counts.emplace_back(static_cast<int>(i), idx_occurrences[i] - 1);
 	}
 
-	std::pmr::vector<std::pair<int, int>> idx_counts(&mbr);
-	for (auto& pair : idx_count_map)
-	{
-		idx_counts.push_back(pair);
-	}
+	if (idx_counts.empty())
+		return 0;
 
 	std::ranges::sort(idx_counts, [](auto& a, auto& b) { return a.second < b.second; });
 	// 选择 出现次数最最最多的数字
@@ -205,103 +188,492 @@ struct filename_human_compare
 
 };
 
-template<ContainerType Container, typename Allocator>
-auto get_base_names(Container&& files, Allocator alloc)
+// 返回排好序的行号, 文件表本身不动.
+// limit 不是 0 的时候只要排在最前面的 limit 个, 其余的直接丢掉:
+// 先 nth_element 选出前 limit 个, 只对这一段排序
+static std::pmr::vector<std::uint32_t> sort_by_masked_name(const file_table& table, std::pmr::memory_resource* mr, std::size_t limit = 0)
 {
-	std::pmr::vector<std::pmr::string> ret(alloc);
-	ret.reserve(files.size());
+	std::pmr::vector<std::uint32_t> order(table.size(), 0, mr);
+	for (std::uint32_t i = 0; i < order.size(); i++)
+		order[i] = i;
 
-	for (auto f : files)
+	filename_human_compare compare;
+	auto less = [&](auto a, auto b) { return compare(table.sort_key(a), table.sort_key(b)); };
+	if (limit != 0 && limit < order.size())
 	{
-		#ifdef _WIN32
-		ret.emplace_back(nowide::narrow(std::filesystem::path(nowide::widen(f)).stem().wstring()));
-		#else
-		ret.emplace_back(std::filesystem::path(f).stem().string());
-		#endif
+		std::ranges::nth_element(order, order.begin() + limit, less);
+		order.resize(limit);
 	}
-
-	return ret;
+	std::ranges::sort(order, less);
+	return order;
 }
 
-struct output
+enum class cluster_mode
 {
-	std::ostream& outstream;
-	bool is_tty;
+	none,
+	name_template,
+	fuzzy,
 };
 
-std::vector<output> get_outputs()
+enum class dedupe_mode
 {
-	std::vector<output> outputs;
-	std::ostream* output = nullptr;
+	none,
+	best,
+};
 
-	std::ofstream m3u8;
+struct options
+{
+	// 可以给好几个目录, 一个一个处理, 每个目录一份播放列表
+	std::vector<std::string> target_dirs;
+	std::string tag_file;
+	cluster_mode cluster = cluster_mode::none;
+	dedupe_mode dedupe = dedupe_mode::none;
+	fsync_policy sync = fsync_policy::none;
+	playlist_format_id format = playlist_format_id::m3u8;
+	bool probe = true;
+	unsigned probe_jobs = 4;
+	// 最多输出多少个文件, 0 表示不限
+	std::size_t limit = 0;
+	// 不用旧的探测缓存, 所有文件重新读一遍, 替换掉缓存里这些文件的结果, 别的目录的结果保留
+	bool rebuild_cache = false;
+	// stats_* 的组合
+	unsigned stats = 0;
+};
+
+enum : unsigned
+{
+	stats_probe = 1 << 0,
+	stats_arena = 1 << 1,
+	stats_alloc = 1 << 2,
+	stats_all = ~0u,
+};
+
+static void print_probe_stats(const std::pmr::vector<probe_result>& probed)
+{
+	std::pmr::vector<float> latencies(probed.get_allocator());
+	for (auto& r : probed)
+	{
+		if (!r.cached)
+			latencies.push_back(r.latency_us);
+	}
+
+	auto known = std::ranges::count_if(probed, [](const probe_result& r) { return r.info.duration >= 0; });
+
+	nowide::cerr << "probe: " << probed.size() << " files, " << known << " with duration"
+		<< ", " << probed.size() - latencies.size() << " from cache"
+		<< ", latency us p50=" << percentile(latencies, 50)
+		<< " p90=" << percentile(latencies, 90)
+		<< " p99=" << percentile(latencies, 99)
+		<< " max=" << percentile(latencies, 100) << std::endl;
+}
+
+static void print_arena_stats(const run_arena::statistics& stats)
+{
+	nowide::cerr << "arena: " << stats.allocations << " allocations"
+		<< ", peak " << stats.peak_bytes << " bytes"
+		<< ", reserved " << stats.reserved_bytes << " bytes in " << stats.chunks << " chunks"
+		<< " (" << stats.huge_chunks << " huge)" << std::endl;
+}
+
+// 每个阶段一行, 大小分布只列出有分配的桶, "<=64:12" 表示 33 到 64 字节的分配有 12 次
+// 释放记在分配它的阶段上, 分配的字节数减去释放的字节数就是这个阶段到最后还没还的
+static void print_alloc_stats(const counting_resource::report_type& report)
+{
+	for (std::size_t i = 0; i < report.size(); i++)
+	{
+		auto& s = report[i];
+		if (s.allocations == 0 && s.deallocations == 0)
+			continue;
+
+		nowide::cerr << "alloc " << alloc_stage_name(static_cast<alloc_stage>(i)) << ": "
+			<< s.allocations << " allocations, " << s.bytes << " bytes"
+			<< ", " << s.deallocations << " deallocations, " << s.freed_bytes << " bytes"
+			<< ", peak " << s.peak_bytes << " bytes, sizes";
+		for (std::size_t b = 0; b < s.histogram.size(); b++)
+		{
+			if (s.histogram[b] == 0)
+				continue;
+			if (b + 1 == s.histogram.size())
+				nowide::cerr << " >" << (std::size_t{1} << (b - 1)) << ":" << s.histogram[b];
+			else
+				nowide::cerr << " <=" << (std::size_t{1} << b) << ":" << s.histogram[b];
+		}
+		nowide::cerr << std::endl;
+	}
+}
+
+// 输出到终端的时候, 终端上显示一份, 同时在目录里写一个 000-playlist.m3u8 (或者别的格式)
+// 输出到管道的时候, 直接把播放列表写到标准输出
+std::vector<output_sink> get_outputs(playlist_format_id format, fsync_policy sync)
+{
+	std::vector<output_sink> outputs;
 
 	bool is_tty = isatty(1);
 
 	if (!is_tty)
 	{
-		outputs.push_back({std::cout, is_tty});
-		nowide::cout << "#EXTM3U" << std::endl;
+		outputs.push_back(output_sink::to_stdout());
 	}
 	else
 	{
-		outputs.push_back({nowide::cout, is_tty});
-		m3u8.open("000-playlist.m3u8");
-		m3u8 << "#EXTM3U" << std::endl;
-		m3u8 << "#EXT-X-TITLE: auto-play-all" << std::endl;
-		outputs.push_back({m3u8, false});
+		outputs.push_back(output_sink::to_tty());
+
+		auto extension = with_playlist_format(format, []<typename Format>() { return Format::extension; });
+		outputs.push_back(output_sink::to_file(std::string{"000-playlist"}.append(extension), sync));
 	}
 	return outputs;
 }
 
-template<ContainerType Container>
-void do_outputs(Container&& files, std::vector<output> outputs)
+// 寻找表征 第几集 的数字所在的位置，用来进行变色打印
+// 文件名列表没变过的话, 直接用上次的检测结果
+static int detect_digi_for_episode(const file_table& table, std::span<const std::uint32_t> rows, episode_cache& detect_cache, std::pmr::memory_resource* mr)
 {
-	std::pmr::monotonic_buffer_resource mbr;
+	// 1080p x265 之类的标签里的数字不参与检测, 文件表里的 masked_stem 已经屏蔽掉了
+	std::pmr::vector<std::string_view> file_names(mr);
+	file_names.reserve(rows.size());
+	for (auto row : rows)
+		file_names.push_back(table.masked_stem(row));
+	auto names_hash = hash64_list(file_names);
+	if (auto cached = detect_cache.lookup(names_hash))
+	{
+		return *cached;
+	}
 
-	// 寻找表征 第几集 的数字所在的位置，用来进行变色打印
-	auto file_names = get_base_names(files, &mbr);
-	auto digi_for_episode = find_digi_for_episode(file_names);
+	auto digi_for_episode = find_digi_for_episode(table, rows, mr);
+	detect_cache.store(names_hash, digi_for_episode);
+	return digi_for_episode;
+}
 
-	for (const auto& file : files)
+// 一部剧的文件 (文件表里的行号, 按顺序), 以及 第几集 所在的位置
+struct series
+{
+	std::pmr::vector<std::uint32_t> files;
+	int digi_for_episode = 0;
+};
+
+// 终端上显示的文件列表, 把 第几集 高亮. rows[i] 是第 i 个文件在文件表里的行号
+static void render_display(render_buffer& buf, const file_table& table, const std::pmr::vector<std::uint32_t>& rows, const highlight_table& highlights)
+{
+	for (std::size_t i = 0; i < rows.size(); i++)
 	{
-		// std::string ff = file.string();
-		std::string_view f = file;
+		render_highlighted(buf, table.display_path(rows[i]), highlights[i]);
+		buf.push_back('\n');
+	}
+}
 
-		for (auto out : outputs)
+// 按剧分好组的文件, 按组的顺序依次输出
+// 播放列表只渲染一次 (终端上的显示再渲染一份), 每个输出端一次性写出去
+static void do_outputs(const std::vector<series>& series_list, file_table& table, std::vector<output_sink>& outputs, const options& opts, probe_cache& media_cache, cancellation& cancel, std::pmr::memory_resource* mr)
+{
+	auto format = opts.format;
+
+	// 时长只有写播放列表的时候才需要, 终端上只是显示文件名. 重建缓存的时候总是要读
+	auto probe = opts.rebuild_cache || (opts.probe
+		&& with_playlist_format(format, []<typename Format>() { return Format::uses_media_info; })
+		&& std::ranges::any_of(outputs, [](const output_sink& out) { return !out.wants_color(); }));
+
+	// 所有格式共用的文件表, 标题是去掉了发布标签的文件名.
+	// 终端上显示的时候, 季和集的位置也在这里一起算好
+	auto display = std::ranges::any_of(outputs, [](const output_sink& out) { return out.wants_color(); });
+	std::size_t estimated_size = 0;
+	std::pmr::vector<playlist_entry> entries(mr);
+	// entries[i] 是文件表的第 rows[i] 行
+	std::pmr::vector<std::uint32_t> rows(mr);
+	highlight_table highlights(mr);
+	// 路径直接指向文件表, 标题放在 mr 里, 都跟文件表活得一样久
+	auto copy_to_arena = [mr](std::string_view str) -> std::string_view
+	{
+		auto chars = static_cast<char*>(mr->allocate(str.size(), 1));
+		std::copy(str.begin(), str.end(), chars);
+		return {chars, str.size()};
+	};
+
+	// 要求绝对路径的格式 (xspf), 相对路径接在当前目录后面, 也放在 mr 里
+	auto absolute_paths = with_playlist_format(format, []<typename Format>() { return Format::absolute_paths; });
+	std::filesystem::path current_dir;
+	if (absolute_paths)
+	{
+		std::error_code ec;
+		current_dir = std::filesystem::current_path(ec);
+	}
+	auto playlist_path = [&](std::string_view path) -> std::string_view
+	{
+		if (!absolute_paths || current_dir.empty())
+			return path;
+		std::filesystem::path p(std::u8string_view{reinterpret_cast<const char8_t*>(path.data()), path.size()});
+		if (p.is_absolute())
+			return path;
+		auto absolute = (current_dir / p).u8string();
+		return copy_to_arena({reinterpret_cast<const char*>(absolute.data()), absolute.size()});
+	};
+
+	for (const auto& s : series_list)
+	{
+		for (auto row : s.files)
 		{
-			if (out.is_tty)
+			auto path = playlist_path(table.path(row));
+			auto stem = table.stem(row);
+			auto title = copy_to_arena(tag_matcher::strip_tags(stem, table.tag_spans(row)));
+			entries.push_back({path, title});
+			rows.push_back(row);
+			estimated_size += path.size() * 2 + 16;
+
+			if (display)
 			{
-				if (digi_for_episode < f.size())
-				{
-					// output color full digit
-					out.outstream << f.substr(0, digi_for_episode);
+				// digi_for_episode 是在 (NFC 的) stem 里的位置, 换算成显示出来的路径里的位置
+				auto v = parse_episode_variant(stem, s.digi_for_episode);
+				highlights.add(table.display_position_of_digit(row, v.season_begin), v.season_length, highlight_role::season);
+				highlights.add(table.display_position_of_digit(row, v.episode_begin), v.episode_length, highlight_role::episode);
+				highlights.next_file();
+			}
+		}
+	}
 
-					auto remain_pos	= digi_for_episode;
-					out.outstream << "\033[0;35m" << "\u001b[1m";
-					while( std::isdigit(f[remain_pos]))
-					{
-						out.outstream << f[remain_pos];
-						remain_pos++;
-					}
+	if (probe)
+	{
+		auto paths = map<std::vector>(entries, [](const playlist_entry& e) { return e.path; });
+		auto probed = probe_all(paths, opts.probe_jobs, media_cache, cancel, mr);
+		if (cancel.poll())
+			return;
 
-					out.outstream << "\033[0m";
-					out.outstream << f.substr(remain_pos);
-				}
-				else
-				{
-					out.outstream << f;
-				}
-				out.outstream << std::endl;
+		for (std::size_t i = 0; i < entries.size(); i++)
+		{
+			auto row = rows[i];
+			entries[i].duration = probed[i].info.duration;
+			table.duration[row] = probed[i].info.duration;
+			if (probed[i].info.duration >= 0)
+				table.flags[row] |= file_table::has_media_info;
+			if (probed[i].cached)
+				table.flags[row] |= file_table::from_cache;
+			if (probed[i].key.ino != 0)
+			{
+				table.file_size[row] = probed[i].key.size;
+				table.mtime_ns[row] = probed[i].key.mtime_ns;
+				table.flags[row] |= file_table::has_stat;
 			}
+		}
+
+		if (opts.stats & stats_probe)
+			print_probe_stats(probed);
+	}
+
+	render_buffer playlist, listing;
+
+	for (auto& out : outputs)
+	{
+		auto& buf = out.wants_color() ? listing : playlist;
+		if (buf.empty())
+		{
+			buf.reserve(estimated_size);
+			if (out.wants_color())
+				render_display(buf, table, rows, highlights);
 			else
+				with_playlist_format(format, [&]<typename Format>() { render_playlist<Format>(buf, entries, "auto-play-all"); });
+		}
+
+		if (cancel.poll())
+			return;
+
+		// 管道把缓冲区整个拿走 (vmsplice), 别的输出端再要的话会重新渲染一份
+		auto ok = out.sink_kind() == output_sink::kind::stdout_pipe ? out.write(std::move(buf)) : out.write(buf);
+		if (!ok)
+		{
+			// 下游不要了, 不算出错
+			if (errno == EPIPE)
 			{
-				out.outstream << f << std::endl;
+				cancel.request_stop();
+				return;
 			}
+			perror("failed to write playlist");
 		}
 	}
 }
 
+// 把排好序的行号按剧分组, 组内保持原来的顺序
+static std::vector<series> split_clusters(const std::pmr::vector<std::uint32_t>& order, const std::pmr::vector<std::uint32_t>& cluster_of, std::pmr::memory_resource* mr)
+{
+	std::vector<series> clusters;
+	for (std::size_t i = 0; i < order.size(); i++)
+	{
+		while (cluster_of[i] >= clusters.size())
+			clusters.push_back({std::pmr::vector<std::uint32_t>(mr)});
+		clusters[cluster_of[i]].files.push_back(order[i]);
+	}
+	return clusters;
+}
+
+// 按组的顺序数, 只留下前 limit 个文件
+static void limit_series(std::vector<series>& series_list, std::size_t limit)
+{
+	for (auto it = series_list.begin(); it != series_list.end(); ++it)
+	{
+		if (it->files.size() >= limit)
+		{
+			it->files.resize(limit);
+			series_list.erase(it + 1, series_list.end());
+			return;
+		}
+		limit -= it->files.size();
+	}
+}
+
+// 同一集只留一个最好的版本
+static void dedupe_series(series& s, file_table& table, std::pmr::memory_resource* mr)
+{
+	std::pmr::vector<std::string_view> stems(mr);
+	stems.reserve(s.files.size());
+	for (auto row : s.files)
+		stems.push_back(table.stem(row));
+
+	// 文件大小记在文件表里, 每个文件最多 stat 一次
+	auto file_size = [&](std::uint32_t i) -> std::uint64_t
+	{
+		auto row = s.files[i];
+		return table.ensure_stat(row) ? table.file_size[row] : 0;
+	};
+
+	auto tag_spans = [&](std::uint32_t i) { return table.tag_spans(s.files[i]); };
+	auto kept = dedupe_best_variant(stems, tag_spans, s.digi_for_episode, file_size, mr);
+	if (kept.size() == s.files.size())
+		return;
+
+	std::pmr::vector<std::uint32_t> deduped(mr);
+	deduped.reserve(kept.size());
+	for (auto i : kept)
+		deduped.push_back(s.files[i]);
+	s.files = std::move(deduped);
+}
+
+static void print_usage()
+{
+	nowide::cerr << "usage: createplaylist [options] [directory...]\n"
+		"  --cluster=none|template|fuzzy  group files of different series before detecting episodes\n"
+		"  --dedupe=none|best  keep only the best version (resolution, vN, size) of each episode of each series,\n"
+		"                      groups files with --cluster=template unless fuzzy clustering is chosen\n"
+		"  --tags=FILE  extra release tags to ignore, one per line (default: tags.txt in the config directory)\n"
+		"  --format=m3u8|pls|xspf|jsonl|list  playlist format\n"
+		"  --no-probe  do not read video headers for durations (#EXTINF:-1)\n"
+		"  --probe-jobs=N  number of video headers read concurrently (default 4)\n"
+		"  --rebuild-cache  re-read every video header, replace their cache entries and compact the cache\n"
+		"  --limit=N  output only the first N videos\n"
+		"  --stats[=probe,arena,alloc]  print statistics to stderr\n"
+		"  --fsync=none|file|full  fsync the playlist file (and its directory) before replacing it\n";
+}
+
+// 返回 false 表示参数有错
+static bool parse_options(int argc, char** argv, options& opts)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string_view arg = argv[i];
+		if (!arg.starts_with("--"))
+		{
+			opts.target_dirs.emplace_back(arg);
+			continue;
+		}
+
+		auto eq = arg.find('=');
+		auto key = arg.substr(0, eq);
+		auto value = eq == std::string_view::npos ? std::string_view{} : arg.substr(eq + 1);
+
+		if (key == "--cluster")
+		{
+			if (value == "none")
+				opts.cluster = cluster_mode::none;
+			else if (value == "template" || value.empty())
+				opts.cluster = cluster_mode::name_template;
+			else if (value == "fuzzy")
+				opts.cluster = cluster_mode::fuzzy;
+			else
+				return false;
+		}
+		else if (key == "--dedupe")
+		{
+			if (value == "none")
+				opts.dedupe = dedupe_mode::none;
+			else if (value == "best" || value.empty())
+				opts.dedupe = dedupe_mode::best;
+			else
+				return false;
+		}
+		else if (key == "--format")
+		{
+			if (value == "m3u8" || value == "m3u")
+				opts.format = playlist_format_id::m3u8;
+			else if (value == "pls")
+				opts.format = playlist_format_id::pls;
+			else if (value == "xspf")
+				opts.format = playlist_format_id::xspf;
+			else if (value == "jsonl" || value == "json")
+				opts.format = playlist_format_id::jsonl;
+			else if (value == "list" || value == "plain")
+				opts.format = playlist_format_id::plain;
+			else
+				return false;
+		}
+		else if (key == "--no-probe" && value.empty())
+		{
+			opts.probe = false;
+		}
+		else if (key == "--probe-jobs")
+		{
+			auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), opts.probe_jobs);
+			if (ec != std::errc{} || end != value.data() + value.size() || opts.probe_jobs == 0)
+				return false;
+		}
+		else if (key == "--limit")
+		{
+			auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), opts.limit);
+			if (ec != std::errc{} || end != value.data() + value.size() || opts.limit == 0)
+				return false;
+		}
+		else if (key == "--rebuild-cache" && value.empty())
+		{
+			opts.rebuild_cache = true;
+		}
+		else if (key == "--stats")
+		{
+			if (value.empty())
+			{
+				opts.stats = stats_all;
+				continue;
+			}
+			for (auto item : std::views::split(value, ','))
+			{
+				std::string_view name{item.begin(), item.end()};
+				if (name == "probe")
+					opts.stats |= stats_probe;
+				else if (name == "arena")
+					opts.stats |= stats_arena;
+				else if (name == "alloc")
+					opts.stats |= stats_alloc;
+				else
+					return false;
+			}
+		}
+		else if (key == "--fsync")
+		{
+			if (value == "none")
+				opts.sync = fsync_policy::none;
+			else if (value == "file")
+				opts.sync = fsync_policy::file;
+			else if (value == "full" || value.empty())
+				opts.sync = fsync_policy::full;
+			else
+				return false;
+		}
+		else if (key == "--tags" && !value.empty())
+		{
+			opts.tag_file = value;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
 #ifdef _WIN32
 int chdir(const char* newdir)
 {
@@ -309,18 +681,37 @@ int chdir(const char* newdir)
 }
 #endif
 
-int main(int argc, char** argv, char** env)
+// 一次运行里所有目录共用的东西
+struct run_context
 {
-	bool is_tty = isatty(1);
+	const options& opts;
+	const tag_matcher& tags;
+	episode_cache& detect_cache;
+	probe_cache& media_cache;
+	// 文件名模板之类反复出现的字符串, 所有目录共用
+	string_pool& strings;
+	cancellation& cancel;
+	run_arena& arena;
+	// 各个阶段的容器都从这里分配: 就是 arena, 或者套在 arena 外面记账的 counting_resource
+	std::pmr::memory_resource* mr;
+	bool is_tty;
+};
+
+// 处理一个目录, 返回退出码. target_dir 为空表示当前目录
+static int process_directory(const std::string& target_dir, run_context& ctx)
+{
+	const auto& opts = ctx.opts;
+	const auto& tags = ctx.tags;
+	auto& cancel = ctx.cancel;
+	std::pmr::memory_resource* mr = ctx.mr;
 	std::string glob_pattern_prefix;
 
-	nowide::args _args{argc, argv, env};
 	// 首先进入到目标目录. 然后列举出所有的视频文件
-	if (argc == 2)
+	if (!target_dir.empty())
 	{
-		if (is_tty)
+		if (ctx.is_tty)
 		{
-			if (chdir(argv[1]) != 0)
+			if (chdir(target_dir.c_str()) != 0)
 			{
 				perror("failed to chdir");
 				return 2;
@@ -328,32 +719,156 @@ int main(int argc, char** argv, char** env)
 		}
 		else
 		{
-			glob_pattern_prefix = argv[1];
+			glob_pattern_prefix = target_dir;
 			glob_pattern_prefix += std::filesystem::path::preferred_separator;
 		}
 	}
 
-	auto globing = [](const auto& glob_pattern_prefix)
-	{
-		auto mkvfiles = glob<std::string>(glob_pattern_prefix + "*.mkv");
-		auto mp4files = glob<std::string>(glob_pattern_prefix + "*.mp4");
-		return concat(mkvfiles, mp4files);
-	};
+	// 所有的文件都放在一张表里, 后面的排序, 分组, 去重都只是在排列行号
+	alloc_stage_scope stage{alloc_stage::scan};
+	file_table table(mr);
+	glob_into(table, glob_pattern_prefix + "*.mkv");
+	if (cancel.poll())
+		return 0;
+	glob_into(table, glob_pattern_prefix + "*.mp4");
+	if (cancel.poll())
+		return 0;
 
-	auto files = globing(glob_pattern_prefix);
+	// 屏蔽了标签的排序键, 以及每个文件名里的数字段, 只算这一次.
+	// 老压缩包解出来的 GBK/Big5 文件名先转换成 UTF-8, 排序和检测都用转换以后的
+	stage.enter(alloc_stage::keys);
+	table.decode_legacy_names();
+	table.build_keys(tags);
 
 	// 进行根据文件名里的自然阿拉伯数字进行排序
-	std::ranges::sort(files, filename_human_compare{});
+	// 排序用的是屏蔽了标签的文件名, 免得 1080p 和 720p 这种数字影响顺序.
+	// 不分组不去重的时候, 排序结果的前 limit 个就是最后输出的, 后面的不用排也不用检测
+	auto partial = opts.cluster == cluster_mode::none && opts.dedupe == dedupe_mode::none;
+	stage.enter(alloc_stage::sort);
+	auto order = sort_by_masked_name(table, mr, partial ? opts.limit : 0);
+	if (cancel.poll())
+		return 0;
 
 	// 最后输出 m3u8 格式
 
-	if (files.empty())
+	if (order.empty())
 	{
 		nowide::cerr << "no videos found" << std::endl;
 		return 1;
 	}
 
-	do_outputs(files, get_outputs());
+	stage.enter(alloc_stage::detect);
+	std::vector<series> clusters;
+	if (opts.cluster != cluster_mode::none)
+	{
+		std::pmr::vector<std::string_view> masked_names(mr);
+		masked_names.reserve(order.size());
+		for (auto row : order)
+			masked_names.push_back(table.masked_stem(row));
+		auto cluster_of = opts.cluster == cluster_mode::fuzzy
+			? cluster_by_similarity(masked_names, mr)
+			: cluster_by_template(masked_names, ctx.strings, mr);
+		clusters = split_clusters(order, cluster_of, mr);
+	}
+	else
+	{
+		clusters.push_back({std::move(order)});
+	}
+
+	for (auto& s : clusters)
+	{
+		if (cancel.poll())
+			return 0;
+		s.digi_for_episode = detect_digi_for_episode(table, s.files, ctx.detect_cache, mr);
+		if (opts.dedupe == dedupe_mode::best)
+			dedupe_series(s, table, mr);
+	}
+
+	if (opts.limit != 0)
+		limit_series(clusters, opts.limit);
+
+	stage.enter(alloc_stage::output);
+	auto outputs = get_outputs(opts.format, opts.sync);
+	do_outputs(clusters, table, outputs, opts, ctx.media_cache, cancel, mr);
 
 	return 0;
 }
+
+int main(int argc, char** argv, char** env)
+{
+	bool is_tty = isatty(1);
+
+	nowide::args _args{argc, argv, env};
+
+	options opts;
+	if (!parse_options(argc, argv, opts))
+	{
+		print_usage();
+		return 2;
+	}
+	// 去重是按 (剧, 季, 集) 去的, 不分组的话两部剧的同一集会被当成同一个文件的两个版本
+	if (opts.dedupe == dedupe_mode::best && opts.cluster == cluster_mode::none)
+		opts.cluster = cluster_mode::name_template;
+
+	// 输出到管道的时候, 下游关掉管道不要让 SIGPIPE 把进程打死, 而是在 write 拿到 EPIPE 以后安静地停下来.
+	// 在那之前各个阶段也会看一眼管道还在不在
+#ifndef _WIN32
+	if (!is_tty)
+		std::signal(SIGPIPE, SIG_IGN);
+#endif
+	cancellation cancel{is_tty ? -1 : 1};
+
+	// 标签字典, 内置的加上用户自己配置的
+	auto tag_list = tag_matcher::default_tags();
+	if (auto config_dir = default_config_directory(); !config_dir.empty())
+	{
+		std::error_code ec;
+		if (std::filesystem::exists(config_dir / "tags.txt", ec))
+			tag_matcher::load_tag_file(config_dir / "tags.txt", tag_list);
+	}
+	if (!opts.tag_file.empty())
+		tag_matcher::load_tag_file(opts.tag_file, tag_list);
+	tag_matcher tags{tag_list};
+
+	auto cache_dir = default_cache_directory();
+	episode_cache detect_cache;
+	if (!cache_dir.empty())
+		detect_cache = episode_cache{cache_dir / "episode-detect.cache"};
+	probe_cache media_cache{cache_dir.empty() ? cache_dir : cache_dir / "media-probe.cache", opts.rebuild_cache};
+
+	run_arena arena;
+	// 要看分配统计的时候才在 arena 外面套一层记账
+	counting_resource counted{&arena};
+	std::pmr::memory_resource* mr = &arena;
+	if (opts.stats & stats_alloc)
+		mr = &counted;
+	string_pool strings;
+	run_context ctx{opts, tags, detect_cache, media_cache, strings, cancel, arena, mr, is_tty};
+
+	if (opts.target_dirs.empty())
+		opts.target_dirs.emplace_back();
+
+	// 终端模式会 chdir 进每个目录, 处理完回到原来的目录, 下一个相对路径才对
+	std::error_code ec;
+	auto original_cwd = std::filesystem::current_path(ec);
+
+	int exit_code = 0;
+	for (const auto& dir : opts.target_dirs)
+	{
+		exit_code = std::max(exit_code, process_directory(dir, ctx));
+		// 上一个目录的东西都不要了, 内存留给下一个目录
+		arena.reset();
+		counted.upstream_released();
+		if (is_tty && !dir.empty())
+			std::filesystem::current_path(original_cwd, ec);
+		if (cancel.poll())
+			break;
+	}
+
+	if (opts.stats & stats_arena)
+		print_arena_stats(arena.stats());
+	if (opts.stats & stats_alloc)
+		print_alloc_stats(counting_resource::report());
+
+	return exit_code;
+}
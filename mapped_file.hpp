@@ -0,0 +1,103 @@
+﻿
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+#include <utility>
+
+// 把整个文件映射到内存. 打开失败或者是空文件的时候 data() 是 nullptr
+// 默认只读; read_write 是共享映射, 通过 writable_data() 写进去的内容会落到文件里
+class mapped_file
+{
+public:
+	enum class access { read_only, read_write };
+
+	mapped_file() = default;
+
+	explicit mapped_file(const std::filesystem::path& path, access mode = access::read_only)
+	{
+		bool writable = mode == access::read_write;
+#ifdef _WIN32
+		HANDLE file = CreateFileW(path.wstring().c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+
+		LARGE_INTEGER file_size;
+		if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+		{
+			HANDLE mapping = CreateFileMappingW(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+			if (mapping)
+			{
+				data_ = static_cast<char*>(MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+				if (data_)
+					size_ = static_cast<std::size_t>(file_size.QuadPart);
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(file);
+#else
+		int fd = ::open(path.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+		if (fd < 0)
+			return;
+
+		struct stat st;
+		if (::fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			auto p = writable
+				? ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+				: ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED)
+			{
+				data_ = static_cast<char*>(p);
+				size_ = static_cast<std::size_t>(st.st_size);
+			}
+		}
+		::close(fd);
+#endif
+	}
+
+	mapped_file(mapped_file&& other) noexcept
+		: data_(std::exchange(other.data_, nullptr))
+		, size_(std::exchange(other.size_, 0))
+	{}
+
+	mapped_file& operator=(mapped_file&& other) noexcept
+	{
+		std::swap(data_, other.data_);
+		std::swap(size_, other.size_);
+		return *this;
+	}
+
+	~mapped_file()
+	{
+		if (!data_)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(data_);
+#else
+		::munmap(data_, size_);
+#endif
+	}
+
+	const char* data() const { return data_; }
+	// 只有以 read_write 打开的时候才能往里写
+	char* writable_data() { return data_; }
+	std::size_t size() const { return size_; }
+
+	operator std::string_view() const { return {data_, size_}; }
+
+private:
+	char* data_ = nullptr;
+	std::size_t size_ = 0;
+};
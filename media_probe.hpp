@@ -0,0 +1,548 @@
+﻿
+#pragma once
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include "nowide/convert.hpp"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// 从视频文件的头部读出时长, 分辨率和编码格式, 用来生成 #EXTINF 以及写入探测缓存.
+// 不解码, 不读整个文件, 也不去启动 ffprobe, 只按需 pread 几个容器头:
+//   .mkv: EBML Segment 里的 Info (Duration, TimestampScale) 和 Tracks
+//   .mp4: moov 里的 mvhd 和每个 trak 的 tkhd/hdlr/stsd, moov 在文件末尾的时候沿着 atom 链跳过去
+struct media_info
+{
+	// 秒, 小于 0 表示不知道
+	double duration = -1;
+	std::uint32_t width = 0;
+	std::uint32_t height = 0;
+	// 编码格式: mkv 是去掉 V_/A_ 前缀的 CodecID (比如 "MPEGH/ISO/HEVC", "AAC"),
+	// mp4 是 sample entry 的类型 (比如 "hev1", "mp4a"). 以 0 结尾, 太长的会被截断
+	std::array<char, 16> video_codec{};
+	std::array<char, 16> audio_codec{};
+};
+
+namespace media_probe_detail
+{
+	// 只读打开, 按偏移读取
+	class positional_file
+	{
+	public:
+		explicit positional_file(std::string_view utf8_path)
+		{
+#ifdef _WIN32
+			fd_ = _wopen(nowide::widen(utf8_path).c_str(), _O_RDONLY | _O_BINARY);
+#else
+			fd_ = ::open(std::string{utf8_path}.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+		}
+
+		positional_file(const positional_file&) = delete;
+		positional_file& operator=(const positional_file&) = delete;
+
+		~positional_file()
+		{
+			if (fd_ < 0)
+				return;
+#ifdef _WIN32
+			_close(fd_);
+#else
+			::close(fd_);
+#endif
+		}
+
+		bool is_open() const { return fd_ >= 0; }
+
+		std::uint64_t size() const
+		{
+#ifdef _WIN32
+			return static_cast<std::uint64_t>(_filelengthi64(fd_));
+#else
+			auto end = ::lseek(fd_, 0, SEEK_END);
+			return end < 0 ? 0 : static_cast<std::uint64_t>(end);
+#endif
+		}
+
+		// 返回实际读到的字节数
+		std::size_t read_at(std::uint64_t offset, void* buf, std::size_t len) const
+		{
+#ifdef _WIN32
+			if (_lseeki64(fd_, static_cast<__int64>(offset), SEEK_SET) < 0)
+				return 0;
+			auto n = _read(fd_, buf, static_cast<unsigned>(len));
+#else
+			auto n = ::pread(fd_, buf, len, static_cast<off_t>(offset));
+#endif
+			return n < 0 ? 0 : static_cast<std::size_t>(n);
+		}
+
+	private:
+		int fd_ = -1;
+	};
+
+	inline std::uint64_t read_be(const unsigned char* p, std::size_t len)
+	{
+		std::uint64_t v = 0;
+		for (std::size_t i = 0; i < len; i++)
+			v = (v << 8) | p[i];
+		return v;
+	}
+
+	inline double read_be_float(const unsigned char* p, std::size_t len)
+	{
+		if (len == 4)
+		{
+			auto bits = static_cast<std::uint32_t>(read_be(p, 4));
+			float f;
+			std::memcpy(&f, &bits, 4);
+			return f;
+		}
+		if (len == 8)
+		{
+			auto bits = read_be(p, 8);
+			double d;
+			std::memcpy(&d, &bits, 8);
+			return d;
+		}
+		return -1;
+	}
+
+	inline void set_codec(std::array<char, 16>& codec, std::string_view name)
+	{
+		codec.fill(0);
+		std::memcpy(codec.data(), name.data(), std::min(name.size(), codec.size() - 1));
+	}
+
+	namespace ebml
+	{
+		constexpr std::uint32_t id_ebml = 0x1A45DFA3;
+		constexpr std::uint32_t id_segment = 0x18538067;
+		constexpr std::uint32_t id_seek_head = 0x114D9B74;
+		constexpr std::uint32_t id_seek = 0x4DBB;
+		constexpr std::uint32_t id_seek_id = 0x53AB;
+		constexpr std::uint32_t id_seek_position = 0x53AC;
+		constexpr std::uint32_t id_info = 0x1549A966;
+		constexpr std::uint32_t id_timestamp_scale = 0x2AD7B1;
+		constexpr std::uint32_t id_duration = 0x4489;
+		constexpr std::uint32_t id_tracks = 0x1654AE6B;
+		constexpr std::uint32_t id_track_entry = 0xAE;
+		constexpr std::uint32_t id_track_type = 0x83;
+		constexpr std::uint32_t id_codec_id = 0x86;
+		constexpr std::uint32_t id_video = 0xE0;
+		constexpr std::uint32_t id_pixel_width = 0xB0;
+		constexpr std::uint32_t id_pixel_height = 0xBA;
+		constexpr std::uint32_t id_cluster = 0x1F43B675;
+
+		constexpr std::uint64_t unknown_size = UINT64_MAX;
+
+		// Info 和 SeekHead 一般只有几十个字节, Tracks 里可能带着 CodecPrivate, 给宽裕一点
+		constexpr std::uint64_t max_element_read = 1024 * 1024;
+
+		struct element
+		{
+			std::uint32_t id;
+			std::uint64_t data_offset;
+			std::uint64_t size;
+
+			std::uint64_t end() const { return size == unknown_size ? UINT64_MAX : data_offset + size; }
+		};
+
+		// EBML 变长整数, 第一个字节里前导 0 的个数决定长度
+		inline std::size_t vint_length(unsigned char first)
+		{
+			for (std::size_t len = 1; len <= 8; len++)
+			{
+				if (first & (0x80 >> (len - 1)))
+					return len;
+			}
+			return 0;
+		}
+
+		// 从内存里解析一个元素头, 返回头的长度, 0 表示数据不够或者格式不对
+		inline std::size_t parse_header(const unsigned char* p, std::size_t avail, std::uint64_t base_offset, element& e)
+		{
+			if (avail == 0)
+				return 0;
+			auto id_len = vint_length(p[0]);
+			if (id_len == 0 || id_len > 4 || id_len >= avail)
+				return 0;
+			auto size_len = vint_length(p[id_len]);
+			if (size_len == 0 || id_len + size_len > avail)
+				return 0;
+
+			e.id = static_cast<std::uint32_t>(read_be(p, id_len));
+
+			// 去掉长度标记位以后剩下 7 * size_len 位, 全 1 表示长度未知
+			auto value_mask = (std::uint64_t{1} << (7 * size_len)) - 1;
+			auto size = read_be(p + id_len, size_len) & value_mask;
+			e.size = size == value_mask ? unknown_size : size;
+			e.data_offset = base_offset + id_len + size_len;
+			return id_len + size_len;
+		}
+
+		inline bool read_header(const positional_file& file, std::uint64_t offset, element& e)
+		{
+			unsigned char buf[12];
+			auto n = file.read_at(offset, buf, sizeof buf);
+			return parse_header(buf, n, offset, e) != 0;
+		}
+
+		// 把一个 (不太大的) 元素的内容整个读进来
+		inline std::vector<unsigned char> read_body(const positional_file& file, const element& e)
+		{
+			if (e.size == unknown_size || e.size > max_element_read)
+				return {};
+			std::vector<unsigned char> body(static_cast<std::size_t>(e.size));
+			body.resize(file.read_at(e.data_offset, body.data(), body.size()));
+			return body;
+		}
+
+		// 遍历内存里的一段元素, fn(id, data, len)
+		template<typename Fn>
+		void for_each_child(const unsigned char* buf, std::size_t n, Fn&& fn)
+		{
+			for (std::size_t pos = 0; pos < n; )
+			{
+				element child;
+				auto header_len = parse_header(buf + pos, n - pos, 0, child);
+				if (header_len == 0 || child.size == unknown_size || child.size > n - pos - header_len)
+					break;
+
+				auto len = static_cast<std::size_t>(child.size);
+				fn(child.id, buf + pos + header_len, len);
+				pos += header_len + len;
+			}
+		}
+
+		inline void parse_info(const std::vector<unsigned char>& body, media_info& result)
+		{
+			std::uint64_t timestamp_scale = 1000000;
+			double duration = -1;
+
+			for_each_child(body.data(), body.size(), [&](std::uint32_t id, const unsigned char* data, std::size_t len)
+			{
+				if (id == id_timestamp_scale && len <= 8)
+					timestamp_scale = read_be(data, len);
+				else if (id == id_duration)
+					duration = read_be_float(data, len);
+			});
+
+			if (duration >= 0)
+				result.duration = duration * static_cast<double>(timestamp_scale) / 1e9;
+		}
+
+		// 第一条视频轨的分辨率和编码, 第一条音频轨的编码
+		inline void parse_tracks(const std::vector<unsigned char>& body, media_info& result)
+		{
+			for_each_child(body.data(), body.size(), [&](std::uint32_t id, const unsigned char* data, std::size_t len)
+			{
+				if (id != id_track_entry)
+					return;
+
+				std::uint64_t track_type = 0;
+				std::string_view codec;
+				std::uint32_t width = 0, height = 0;
+				for_each_child(data, len, [&](std::uint32_t id, const unsigned char* data, std::size_t len)
+				{
+					if (id == id_track_type && len <= 8)
+						track_type = read_be(data, len);
+					else if (id == id_codec_id)
+						codec = {reinterpret_cast<const char*>(data), len};
+					else if (id == id_video)
+					{
+						for_each_child(data, len, [&](std::uint32_t id, const unsigned char* data, std::size_t len)
+						{
+							if (id == id_pixel_width && len <= 4)
+								width = static_cast<std::uint32_t>(read_be(data, len));
+							else if (id == id_pixel_height && len <= 4)
+								height = static_cast<std::uint32_t>(read_be(data, len));
+						});
+					}
+				});
+
+				if (codec.size() > 2 && codec[1] == '_')
+					codec.remove_prefix(2);
+
+				if (track_type == 1 && result.video_codec[0] == 0)
+				{
+					set_codec(result.video_codec, codec);
+					result.width = width;
+					result.height = height;
+				}
+				else if (track_type == 2 && result.audio_codec[0] == 0)
+				{
+					set_codec(result.audio_codec, codec);
+				}
+			});
+		}
+
+		// 从 SeekHead 里找 Info 和 Tracks 的位置, 是相对 Segment 数据开头的偏移
+		inline void parse_seek_head(const std::vector<unsigned char>& body, std::uint64_t& info_position, std::uint64_t& tracks_position)
+		{
+			for_each_child(body.data(), body.size(), [&](std::uint32_t id, const unsigned char* data, std::size_t len)
+			{
+				if (id != id_seek)
+					return;
+
+				std::uint32_t target_id = 0;
+				std::uint64_t target_position = UINT64_MAX;
+				for_each_child(data, len, [&](std::uint32_t id, const unsigned char* data, std::size_t len)
+				{
+					if (id == id_seek_id && len <= 4)
+						target_id = static_cast<std::uint32_t>(read_be(data, len));
+					else if (id == id_seek_position && len <= 8)
+						target_position = read_be(data, len);
+				});
+
+				if (target_id == id_info)
+					info_position = target_position;
+				else if (target_id == id_tracks)
+					tracks_position = target_position;
+			});
+		}
+
+		inline media_info probe(const positional_file& file)
+		{
+			media_info result;
+
+			element header;
+			if (!read_header(file, 0, header) || header.id != id_ebml || header.size == unknown_size)
+				return result;
+
+			element segment;
+			if (!read_header(file, header.end(), segment) || segment.id != id_segment)
+				return result;
+
+			bool have_info = false, have_tracks = false;
+			std::uint64_t info_position = UINT64_MAX, tracks_position = UINT64_MAX;
+
+			// 一般 Info 和 Tracks 就在 Segment 的开头几个元素里; 碰到 Cluster 说明后面全是数据了
+			auto offset = segment.data_offset;
+			for (int i = 0; i < 32 && offset < segment.end() && !(have_info && have_tracks); i++)
+			{
+				element child;
+				if (!read_header(file, offset, child) || child.size == unknown_size)
+					break;
+
+				if (child.id == id_info)
+				{
+					parse_info(read_body(file, child), result);
+					have_info = true;
+				}
+				else if (child.id == id_tracks)
+				{
+					parse_tracks(read_body(file, child), result);
+					have_tracks = true;
+				}
+				else if (child.id == id_seek_head)
+				{
+					parse_seek_head(read_body(file, child), info_position, tracks_position);
+				}
+				else if (child.id == id_cluster)
+				{
+					break;
+				}
+
+				offset = child.end();
+			}
+
+			// 没在开头找到的, 按 SeekHead 给的位置跳过去
+			element e;
+			if (!have_info && info_position != UINT64_MAX
+				&& read_header(file, segment.data_offset + info_position, e) && e.id == id_info)
+				parse_info(read_body(file, e), result);
+
+			if (!have_tracks && tracks_position != UINT64_MAX
+				&& read_header(file, segment.data_offset + tracks_position, e) && e.id == id_tracks)
+				parse_tracks(read_body(file, e), result);
+
+			return result;
+		}
+	}
+
+	namespace mp4
+	{
+		struct atom
+		{
+			char type[4];
+			std::uint64_t data_offset;
+			std::uint64_t end;
+
+			bool is(const char (&t)[5]) const { return std::memcmp(type, t, 4) == 0; }
+		};
+
+		inline bool read_atom(const positional_file& file, std::uint64_t offset, std::uint64_t parent_end, atom& a)
+		{
+			unsigned char buf[16];
+			if (offset + 8 > parent_end || file.read_at(offset, buf, sizeof buf) < 8)
+				return false;
+
+			auto size = read_be(buf, 4);
+			std::memcpy(a.type, buf + 4, 4);
+			std::uint64_t header_len = 8;
+			if (size == 1)
+			{
+				// 64 位的 largesize
+				if (offset + 16 > parent_end)
+					return false;
+				size = read_be(buf + 8, 8);
+				header_len = 16;
+			}
+			else if (size == 0)
+			{
+				// 一直到父容器结束
+				size = parent_end - offset;
+			}
+
+			if (size < header_len || offset + size > parent_end)
+				return false;
+
+			a.data_offset = offset + header_len;
+			a.end = offset + size;
+			return true;
+		}
+
+		inline void parse_mvhd(const positional_file& file, const atom& mvhd, media_info& result)
+		{
+			unsigned char buf[32];
+			auto n = file.read_at(mvhd.data_offset, buf, sizeof buf);
+			if (n < 20)
+				return;
+
+			std::uint64_t timescale, duration;
+			if (buf[0] == 1)
+			{
+				if (n < 32)
+					return;
+				timescale = read_be(buf + 20, 4);
+				duration = read_be(buf + 24, 8);
+				if (duration == UINT64_MAX)
+					return;
+			}
+			else
+			{
+				timescale = read_be(buf + 12, 4);
+				duration = read_be(buf + 16, 4);
+				if (duration == UINT32_MAX)
+					return;
+			}
+
+			if (timescale != 0)
+				result.duration = static_cast<double>(duration) / static_cast<double>(timescale);
+		}
+
+		// 在 parent 的子 atom 里找 type, 找到返回 true
+		inline bool find_child(const positional_file& file, const atom& parent, const char (&type)[5], atom& found)
+		{
+			for (auto p = parent.data_offset; read_atom(file, p, parent.end, found); p = found.end)
+			{
+				if (found.is(type))
+					return true;
+			}
+			return false;
+		}
+
+		// trak: tkhd 里有显示尺寸, mdia/hdlr 说明是视频还是音频, mdia/minf/stbl/stsd 的第一个 entry 就是编码格式
+		inline void parse_trak(const positional_file& file, const atom& trak, media_info& result)
+		{
+			atom mdia, hdlr;
+			if (!find_child(file, trak, "mdia", mdia) || !find_child(file, mdia, "hdlr", hdlr))
+				return;
+
+			unsigned char handler[12];
+			if (file.read_at(hdlr.data_offset, handler, sizeof handler) < sizeof handler)
+				return;
+			bool is_video = std::memcmp(handler + 8, "vide", 4) == 0;
+			bool is_audio = std::memcmp(handler + 8, "soun", 4) == 0;
+			if ((!is_video || result.video_codec[0]) && (!is_audio || result.audio_codec[0]))
+				return;
+
+			char codec[5] = {};
+			atom minf, stbl, stsd;
+			if (find_child(file, mdia, "minf", minf) && find_child(file, minf, "stbl", stbl) && find_child(file, stbl, "stsd", stsd))
+			{
+				// version/flags(4) entry_count(4) 然后是第一个 sample entry: size(4) type(4)
+				unsigned char entry[16];
+				if (file.read_at(stsd.data_offset, entry, sizeof entry) == sizeof entry)
+					std::memcpy(codec, entry + 12, 4);
+			}
+
+			if (is_audio)
+			{
+				set_codec(result.audio_codec, codec);
+				return;
+			}
+
+			set_codec(result.video_codec, codec);
+
+			atom tkhd;
+			if (find_child(file, trak, "tkhd", tkhd))
+			{
+				// 宽高是 16.16 定点数, 在 tkhd 的最后 8 个字节
+				unsigned char dims[8];
+				if (tkhd.end - tkhd.data_offset >= 84 && file.read_at(tkhd.end - 8, dims, sizeof dims) == sizeof dims)
+				{
+					result.width = static_cast<std::uint32_t>(read_be(dims, 4) >> 16);
+					result.height = static_cast<std::uint32_t>(read_be(dims + 4, 4) >> 16);
+				}
+			}
+		}
+
+		inline media_info probe(const positional_file& file)
+		{
+			media_info result;
+			auto file_size = file.size();
+
+			// 顶层的 atom 链, 只读每个 atom 的头, mdat 再大也是直接跳过
+			atom top;
+			for (std::uint64_t offset = 0; read_atom(file, offset, file_size, top); offset = top.end)
+			{
+				if (!top.is("moov"))
+					continue;
+
+				atom child;
+				for (auto p = top.data_offset; read_atom(file, p, top.end, child); p = child.end)
+				{
+					if (child.is("mvhd"))
+						parse_mvhd(file, child, result);
+					else if (child.is("trak"))
+						parse_trak(file, child, result);
+				}
+				break;
+			}
+			return result;
+		}
+	}
+}
+
+inline media_info probe_media(std::string_view utf8_path)
+{
+	using namespace media_probe_detail;
+
+	positional_file file(utf8_path);
+	if (!file.is_open())
+		return {};
+
+	// 不相信扩展名, 看文件头: EBML 的 magic 或者 mp4 的 ftyp/moov 之类的 atom
+	unsigned char magic[8];
+	if (file.read_at(0, magic, sizeof magic) < sizeof magic)
+		return {};
+
+	if (read_be(magic, 4) == ebml::id_ebml)
+		return ebml::probe(file);
+	return mp4::probe(file);
+}
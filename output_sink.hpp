@@ -0,0 +1,358 @@
+﻿
+#pragma once
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "nowide/convert.hpp"
+#include "nowide/iostream.hpp"
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <sys/uio.h>
+#include <sys/xattr.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "hash_util.hpp"
+#include "mapped_file.hpp"
+#include "playlist_writer.hpp"
+
+// 写文件的时候要不要 fsync
+enum class fsync_policy
+{
+	none,
+	// fsync 临时文件以后再 rename
+	file,
+	// 还要 fsync 所在的目录, 保证 rename 本身也落盘
+	full,
+};
+
+// 播放列表的输出端: 标准输出 (管道), 终端, 或者文件.
+// 输出端自己拥有文件句柄, 可以移动不可以复制.
+// 播放列表只渲染一次, 然后交给每个输出端, 由输出端按自己的批量策略写出去.
+//
+// 标准输出是管道的时候 (createplaylist | mpv --playlist=-), Linux 上用 vmsplice 把渲染缓冲区的页
+// 直接挂到管道上, 播放器读到的就是这些页, 中间没有 write 的那次拷贝. 不是管道或者 vmsplice 不支持就退回 write.
+//
+// 文件输出端先写临时文件再 rename 过去, 所以别人永远看不到写了一半的播放列表.
+// 如果内容和现有的文件一模一样, 就什么都不写, 连 mtime 都不动,
+// 媒体服务器也就不会因为 mtime 变了而重新扫描.
+class output_sink
+{
+public:
+	enum class kind
+	{
+		stdout_pipe,
+		tty,
+		file,
+	};
+
+	// 每次最多写多少字节, 0 表示整块一次写完
+	struct batch_policy
+	{
+		std::size_t chunk_size = 0;
+	};
+
+	static output_sink to_stdout()
+	{
+		return output_sink{kind::stdout_pipe, 1, false, {}};
+	}
+
+	// 终端上分块写, 让人先看到前面的内容, 不用等整个列表
+	static output_sink to_tty()
+	{
+		return output_sink{kind::tty, 1, false, batch_policy{64 * 1024}};
+	}
+
+	// 文件要到 write 的时候才会创建
+	static output_sink to_file(std::filesystem::path path, fsync_policy sync = fsync_policy::none)
+	{
+		output_sink sink{kind::file, -1, true, {}};
+		sink.path_ = std::move(path);
+		sink.sync_ = sync;
+		return sink;
+	}
+
+	output_sink(output_sink&& other) noexcept
+		: kind_(other.kind_)
+		, fd_(std::exchange(other.fd_, -1))
+		, owns_fd_(std::exchange(other.owns_fd_, false))
+		, batch_(other.batch_)
+		, path_(std::move(other.path_))
+		, sync_(other.sync_)
+		, unchanged_(other.unchanged_)
+	{}
+
+	output_sink& operator=(output_sink&& other) noexcept
+	{
+		std::swap(kind_, other.kind_);
+		std::swap(fd_, other.fd_);
+		std::swap(owns_fd_, other.owns_fd_);
+		std::swap(batch_, other.batch_);
+		std::swap(path_, other.path_);
+		std::swap(sync_, other.sync_);
+		std::swap(unchanged_, other.unchanged_);
+		return *this;
+	}
+
+	output_sink(const output_sink&) = delete;
+	output_sink& operator=(const output_sink&) = delete;
+
+	~output_sink()
+	{
+		close_fd();
+	}
+
+	bool is_open() const { return fd_ >= 0 || kind_ == kind::file; }
+
+	// 上一次 write 是不是因为内容没变而跳过了
+	bool unchanged() const { return unchanged_; }
+
+	// 终端上要把 第几集 高亮
+	bool wants_color() const { return kind_ == kind::tty; }
+
+	kind sink_kind() const { return kind_; }
+
+	// 写出渲染好的播放列表. 出错返回 false, errno 里是错误原因
+	bool write(std::string_view body)
+	{
+		if (kind_ == kind::file)
+			return replace_file(body);
+
+		if (batch_.chunk_size == 0)
+			return write_all(body);
+
+		for (std::size_t pos = 0; pos < body.size(); pos += batch_.chunk_size)
+		{
+			if (!write_all(body.substr(pos, batch_.chunk_size)))
+				return false;
+		}
+		return true;
+	}
+
+	// 把缓冲区整个交出来写. 用了 vmsplice 的话管道里引用的就是缓冲区的页,
+	// 读的一方读完之前这些页不能再改, 所以缓冲区的所有权也一起交出来, 写完就释放 (munmap 不影响管道).
+	bool write(render_buffer&& body)
+	{
+		auto owned = std::move(body);
+		std::string_view rest = owned;
+#ifdef __linux__
+		if (kind_ == kind::stdout_pipe)
+			rest.remove_prefix(splice_to_pipe(rest));
+#endif
+		return write(rest);
+	}
+
+private:
+	// 存在 xattr 里的内容指纹, 只有文件的大小和 mtime 都还对得上的时候才可信
+	struct content_stamp
+	{
+		std::uint64_t hash;
+		std::uint64_t size;
+		std::int64_t mtime_ns;
+	};
+
+	static constexpr const char* stamp_xattr = "user.createplaylist.hash";
+
+	bool is_unchanged(std::uint64_t content_hash, std::size_t content_size) const
+	{
+#ifdef __linux__
+		struct stat st;
+		if (::stat(path_.c_str(), &st) != 0)
+			return false;
+		if (static_cast<std::uint64_t>(st.st_size) != content_size)
+			return false;
+
+		content_stamp stamp;
+		if (::getxattr(path_.c_str(), stamp_xattr, &stamp, sizeof stamp) == sizeof stamp)
+		{
+			auto mtime_ns = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+			if (stamp.size == content_size && stamp.mtime_ns == mtime_ns)
+				return stamp.hash == content_hash;
+		}
+#endif
+		// 没有可信的指纹, 把现有的文件映射进来算一遍
+		mapped_file existing(path_);
+		if (existing.size() != content_size)
+			return false;
+
+		return hash64(existing) == content_hash;
+	}
+
+	bool replace_file(std::string_view body)
+	{
+		auto content_hash = hash64(body);
+		unchanged_ = is_unchanged(content_hash, body.size());
+		if (unchanged_)
+			return true;
+
+		auto tmp_path = path_;
+#ifdef _WIN32
+		tmp_path += ".tmp" + std::to_string(_getpid());
+		fd_ = _wopen(tmp_path.wstring().c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+		tmp_path += ".tmp" + std::to_string(::getpid());
+		fd_ = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+		if (fd_ < 0)
+			return false;
+
+#ifndef _WIN32
+		// rename 过去的是新文件, 不把原来的权限带过去的话, 0600 的播放列表就变成谁都能读的了
+		struct stat target;
+		if (::stat(path_.c_str(), &target) == 0)
+			::fchmod(fd_, target.st_mode & 07777);
+#endif
+
+		bool ok = write_all(body);
+
+		if (ok && sync_ != fsync_policy::none)
+		{
+#ifdef _WIN32
+			ok = _commit(fd_) == 0;
+#else
+			ok = ::fsync(fd_) == 0;
+#endif
+		}
+
+#ifdef __linux__
+		// 记下内容指纹, 下次不用读文件就能知道内容有没有变. 失败了也无所谓
+		struct stat st;
+		if (ok && ::fstat(fd_, &st) == 0)
+		{
+			content_stamp stamp{content_hash, body.size(), static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec};
+			::fsetxattr(fd_, stamp_xattr, &stamp, sizeof stamp, 0);
+		}
+#endif
+
+		auto saved_errno = errno;
+		close_fd();
+
+		std::error_code ec;
+		if (ok)
+			std::filesystem::rename(tmp_path, path_, ec);
+
+		if (!ok || ec)
+		{
+			std::filesystem::remove(tmp_path, ec);
+			errno = saved_errno;
+			return false;
+		}
+
+#ifndef _WIN32
+		if (sync_ == fsync_policy::full)
+		{
+			auto dir = path_.parent_path();
+			int dir_fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (dir_fd >= 0)
+			{
+				::fsync(dir_fd);
+				::close(dir_fd);
+			}
+		}
+#endif
+		return true;
+	}
+
+	void close_fd()
+	{
+		if (owns_fd_ && fd_ >= 0)
+		{
+#ifdef _WIN32
+			_close(fd_);
+#else
+			::close(fd_);
+#endif
+		}
+		if (owns_fd_)
+			fd_ = -1;
+	}
+
+	output_sink(kind k, int fd, bool owns_fd, batch_policy batch)
+		: kind_(k)
+		, fd_(fd)
+		, owns_fd_(owns_fd)
+		, batch_(batch)
+	{}
+
+#ifdef __linux__
+	// 返回用 vmsplice 送出去了多少字节, 剩下的由调用者用 write 接着写
+	std::size_t splice_to_pipe(std::string_view data)
+	{
+		struct stat st;
+		if (::fstat(fd_, &st) != 0 || !S_ISFIFO(st.st_mode))
+			return 0;
+
+		std::size_t done = 0;
+		while (done < data.size())
+		{
+			iovec iov{const_cast<char*>(data.data() + done), data.size() - done};
+			auto n = ::vmsplice(fd_, &iov, 1, 0);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				// EPIPE 之类的错误留给 write 去报告
+				break;
+			}
+			done += static_cast<std::size_t>(n);
+		}
+		return done;
+	}
+#endif
+
+	// 处理被信号打断和只写了一部分的情况
+	bool write_all(std::string_view data)
+	{
+#ifdef _WIN32
+		if (kind_ == kind::tty)
+		{
+			// 控制台要经过 nowide 转成 UTF-16 才能正确显示
+			nowide::cout.write(data.data(), data.size());
+			nowide::cout.flush();
+			return static_cast<bool>(nowide::cout);
+		}
+#endif
+		while (!data.empty())
+		{
+#ifdef _WIN32
+			auto n = _write(fd_, data.data(), static_cast<unsigned>(std::min<std::size_t>(data.size(), 1u << 30)));
+#else
+			auto n = ::write(fd_, data.data(), data.size());
+#endif
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return false;
+			}
+			data.remove_prefix(n);
+		}
+		return true;
+	}
+
+	kind kind_;
+	int fd_ = -1;
+	bool owns_fd_ = false;
+	batch_policy batch_;
+	std::filesystem::path path_;
+	fsync_policy sync_ = fsync_policy::none;
+	bool unchanged_ = false;
+};
@@ -0,0 +1,427 @@
+﻿
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CREATEPLAYLIST_HAVE_SSE2 1
+#endif
+
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "playlist_writer.hpp"
+#include "utf8_codec.hpp"
+
+// 播放列表里的一项. 格式无关, 渲染的时候再由各个格式的 writer 决定怎么写
+struct playlist_entry
+{
+	std::string_view path;
+	std::string_view title;
+	// 秒, 小于 0 表示不知道
+	double duration = -1;
+};
+
+enum class playlist_format_id
+{
+	m3u8,
+	pls,
+	xspf,
+	jsonl,
+	plain,
+};
+
+namespace escape
+{
+	// 在 str 里找第一个需要转义的字节, 找不到返回 str.size().
+	// 需要转义的是 specials 里的字符, 以及 (如果 escape_control) 小于 0x20 的控制字符.
+	// 绝大多数文件名都不需要转义, 所以用 SSE2 一次检查 16 个字节.
+	template<char... specials>
+	std::size_t find_special(std::string_view str, bool escape_control)
+	{
+		std::size_t i = 0;
+#ifdef CREATEPLAYLIST_HAVE_SSE2
+		const __m128i control_max = _mm_set1_epi8(0x1F);
+		for (; i + 16 <= str.size(); i += 16)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str.data() + i));
+			__m128i hit = _mm_setzero_si128();
+			((hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(specials)))), ...);
+			if (escape_control)
+				hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_min_epu8(v, control_max), v));
+
+			if (auto mask = _mm_movemask_epi8(hit))
+			{
+				int bit = 0;
+				while (!(mask & (1 << bit)))
+					bit++;
+				return i + bit;
+			}
+		}
+#endif
+		for (; i < str.size(); i++)
+		{
+			auto c = static_cast<unsigned char>(str[i]);
+			if (((c == static_cast<unsigned char>(specials)) || ...) || (escape_control && c < 0x20))
+				return i;
+		}
+		return str.size();
+	}
+
+	// XML 和 JSON 都必须是合法的 UTF-8. 文件名里没能转换的 GBK/Big5 之类的字节换成 U+FFFD
+	// (按 "最大子部分" 的规则, 和 utf8::decode 一样), 合法的部分交给 escape_valid 转义.
+	// 绝大多数文件名整个都是合法的, 先整体校验一遍, 走不到逐个序列检查的慢路径
+	template<typename Escape>
+	void replacing_invalid_utf8(render_buffer& buf, std::string_view str, Escape&& escape_valid)
+	{
+		if (utf8::validate(str.data(), str.size()))
+		{
+			escape_valid(buf, str);
+			return;
+		}
+
+		auto p = reinterpret_cast<const unsigned char*>(str.data());
+		std::size_t run = 0;
+		for (std::size_t i = 0; i < str.size();)
+		{
+			if (auto length = utf8::valid_length_one(p + i, str.size() - i))
+			{
+				i += length;
+				continue;
+			}
+			escape_valid(buf, str.substr(run, i - run));
+			buf.append("\xEF\xBF\xBD");
+			char32_t cp;
+			i += utf8::decode_one(p + i, str.size() - i, cp);
+			run = i;
+		}
+		escape_valid(buf, str.substr(run));
+	}
+
+	inline void xml_valid_utf8(render_buffer& buf, std::string_view str)
+	{
+		for (;;)
+		{
+			auto pos = find_special<'&', '<', '>', '"', '\''>(str, true);
+			buf.append(str.substr(0, pos));
+			if (pos == str.size())
+				return;
+
+			switch (str[pos])
+			{
+				case '&': buf.append("&amp;"); break;
+				case '<': buf.append("&lt;"); break;
+				case '>': buf.append("&gt;"); break;
+				case '"': buf.append("&quot;"); break;
+				case '\'': buf.append("&apos;"); break;
+				case '\t': buf.append("&#9;"); break;
+				// XML 1.0 里不允许出现其他控制字符, 直接丢掉
+				default: break;
+			}
+			str.remove_prefix(pos + 1);
+		}
+	}
+
+	inline void xml(render_buffer& buf, std::string_view str)
+	{
+		replacing_invalid_utf8(buf, str, xml_valid_utf8);
+	}
+
+	inline void json_valid_utf8(render_buffer& buf, std::string_view str)
+	{
+		for (;;)
+		{
+			auto pos = find_special<'"', '\\'>(str, true);
+			buf.append(str.substr(0, pos));
+			if (pos == str.size())
+				return;
+
+			auto c = static_cast<unsigned char>(str[pos]);
+			switch (c)
+			{
+				case '"': buf.append("\\\""); break;
+				case '\\': buf.append("\\\\"); break;
+				case '\n': buf.append("\\n"); break;
+				case '\r': buf.append("\\r"); break;
+				case '\t': buf.append("\\t"); break;
+				default:
+				{
+					constexpr char hex[] = "0123456789abcdef";
+					char u[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+					buf.append({u, sizeof u});
+				}
+			}
+			str.remove_prefix(pos + 1);
+		}
+	}
+
+	inline void json(render_buffer& buf, std::string_view str)
+	{
+		replacing_invalid_utf8(buf, str, json_valid_utf8);
+	}
+
+	// 原样的字节, 给不是 UTF-8 的路径用
+	inline void base64(render_buffer& buf, std::string_view str)
+	{
+		constexpr char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		auto p = reinterpret_cast<const unsigned char*>(str.data());
+		std::size_t i = 0;
+		for (; i + 3 <= str.size(); i += 3)
+		{
+			std::uint32_t v = p[i] << 16 | p[i + 1] << 8 | p[i + 2];
+			char quad[] = {digits[v >> 18], digits[v >> 12 & 63], digits[v >> 6 & 63], digits[v & 63]};
+			buf.append({quad, sizeof quad});
+		}
+		if (auto rest = str.size() - i)
+		{
+			std::uint32_t v = p[i] << 16 | (rest == 2 ? p[i + 1] << 8 : 0);
+			char quad[] = {digits[v >> 18], digits[v >> 12 & 63], rest == 2 ? digits[v >> 6 & 63] : '=', '='};
+			buf.append({quad, sizeof quad});
+		}
+	}
+
+	// 把路径变成 URI 引用. 非保留字符原样输出, 其他字节 (包括 UTF-8 的多字节序列) 百分号编码
+	inline void uri(render_buffer& buf, std::string_view path)
+	{
+		static constexpr auto unreserved = []
+		{
+			std::array<bool, 256> t{};
+			for (int c = 'A'; c <= 'Z'; c++) t[c] = true;
+			for (int c = 'a'; c <= 'z'; c++) t[c] = true;
+			for (int c = '0'; c <= '9'; c++) t[c] = true;
+			for (unsigned char c : std::string_view{"-._~/!$()*,;=:@"}) t[c] = true;
+			return t;
+		}();
+
+		constexpr char hex[] = "0123456789ABCDEF";
+		std::size_t run = 0;
+		for (std::size_t i = 0; i < path.size(); i++)
+		{
+			auto c = static_cast<unsigned char>(path[i]);
+			if (unreserved[c])
+				continue;
+
+			buf.append(path.substr(run, i - run));
+			run = i + 1;
+			if (c == '\\')
+			{
+				buf.push_back('/');
+				continue;
+			}
+			char encoded[] = {'%', hex[c >> 4], hex[c & 0xF]};
+			buf.append({encoded, sizeof encoded});
+		}
+		buf.append(path.substr(run));
+	}
+
+	// 绝对路径变成 file: URI. "/a b" 是 "file:///a%20b", Windows 的 "C:\a" 是 "file:///C:/a",
+	// 网络路径 "\\server\share" 是 "file://server/share"
+	inline void file_uri(render_buffer& buf, std::string_view path)
+	{
+		auto is_slash = [](char c) { return c == '/' || c == '\\'; };
+		if (path.size() >= 2 && is_slash(path[0]) && is_slash(path[1]))
+			buf << "file:";
+		else if (!path.empty() && is_slash(path[0]))
+			buf << "file://";
+		else
+			buf << "file:///";
+		uri(buf, path);
+	}
+
+	template<typename Integer>
+	void number(render_buffer& buf, Integer n)
+	{
+		char digits[24];
+		auto [end, ec] = std::to_chars(std::begin(digits), std::end(digits), n);
+		buf.append({digits, static_cast<std::size_t>(end - digits)});
+	}
+
+	// 时长取整到秒, 不知道的时候是 -1
+	inline void seconds(render_buffer& buf, double duration)
+	{
+		number(buf, duration < 0 ? -1ll : static_cast<long long>(duration + 0.5));
+	}
+}
+
+// 各种播放列表格式的 writer.
+// 每个格式都是一个 policy, 提供 header / entry / footer 三个静态函数,
+// uses_media_info 表示这个格式会不会输出时长, 不输出的话就不用去读视频文件头了.
+// absolute_paths 表示这个格式要求绝对路径, 相对路径由调用者事先转换好.
+// render_playlist<Format> 在编译期就把它们展开了, 渲染每一行的时候没有运行期的格式分派.
+struct m3u8_format
+{
+	static constexpr std::string_view extension = ".m3u8";
+	static constexpr bool uses_media_info = true;
+	static constexpr bool absolute_paths = false;
+
+	static void header(render_buffer& buf, std::string_view title, std::size_t)
+	{
+		buf << "#EXTM3U\n#EXT-X-TITLE: " << title << "\n";
+	}
+
+	static void entry(render_buffer& buf, const playlist_entry& e, std::size_t)
+	{
+		buf << "#EXTINF:";
+		escape::seconds(buf, e.duration);
+		buf << "," << e.title << "\n" << e.path << "\n";
+	}
+
+	static void footer(render_buffer&, std::size_t) {}
+};
+
+struct pls_format
+{
+	static constexpr std::string_view extension = ".pls";
+	static constexpr bool uses_media_info = true;
+	static constexpr bool absolute_paths = false;
+
+	static void header(render_buffer& buf, std::string_view, std::size_t)
+	{
+		buf << "[playlist]\n";
+	}
+
+	static void entry(render_buffer& buf, const playlist_entry& e, std::size_t index)
+	{
+		buf << "File";
+		escape::number(buf, index + 1);
+		buf << "=" << e.path << "\nTitle";
+		escape::number(buf, index + 1);
+		buf << "=" << e.title << "\nLength";
+		escape::number(buf, index + 1);
+		buf << "=";
+		escape::seconds(buf, e.duration);
+		buf << "\n";
+	}
+
+	static void footer(render_buffer& buf, std::size_t count)
+	{
+		buf << "NumberOfEntries=";
+		escape::number(buf, count);
+		buf << "\nVersion=2\n";
+	}
+};
+
+struct xspf_format
+{
+	static constexpr std::string_view extension = ".xspf";
+	static constexpr bool uses_media_info = true;
+	static constexpr bool absolute_paths = true;
+
+	static void header(render_buffer& buf, std::string_view title, std::size_t)
+	{
+		buf << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			"<playlist version=\"1\" xmlns=\"http://xspf.org/ns/0/\">\n"
+			"  <title>";
+		escape::xml(buf, title);
+		buf << "</title>\n  <trackList>\n";
+	}
+
+	static void entry(render_buffer& buf, const playlist_entry& e, std::size_t)
+	{
+		buf << "    <track><location>";
+		// location 是 file: URI, 相对的 URI 各个播放器解析得不一样.
+		// 百分号编码以后 & 之类的字符已经不存在了, 不用再做 XML 转义
+		escape::file_uri(buf, e.path);
+		buf << "</location><title>";
+		escape::xml(buf, e.title);
+		buf << "</title>";
+		if (e.duration >= 0)
+		{
+			// xspf 的 duration 单位是毫秒
+			buf << "<duration>";
+			escape::number(buf, static_cast<long long>(e.duration * 1000 + 0.5));
+			buf << "</duration>";
+		}
+		buf << "</track>\n";
+	}
+
+	static void footer(render_buffer& buf, std::size_t)
+	{
+		buf << "  </trackList>\n</playlist>\n";
+	}
+};
+
+// 一行一个 JSON 对象, 方便其他工具建索引
+struct jsonl_format
+{
+	static constexpr std::string_view extension = ".jsonl";
+	static constexpr bool uses_media_info = true;
+	static constexpr bool absolute_paths = false;
+
+	static void header(render_buffer&, std::string_view, std::size_t) {}
+
+	static void entry(render_buffer& buf, const playlist_entry& e, std::size_t index)
+	{
+		buf << "{\"index\":";
+		escape::number(buf, index);
+		buf << ",\"path\":\"";
+		escape::json(buf, e.path);
+		// 不是 UTF-8 的路径在 path 里有 U+FFFD, 打不开文件, 另外给一份原样的字节
+		if (!utf8::validate(e.path.data(), e.path.size()))
+		{
+			buf << "\",\"path_base64\":\"";
+			escape::base64(buf, e.path);
+		}
+		buf << "\",\"title\":\"";
+		escape::json(buf, e.title);
+		buf << "\",\"duration\":";
+		if (e.duration >= 0)
+		{
+			char digits[32];
+			auto [end, ec] = std::to_chars(std::begin(digits), std::end(digits), e.duration, std::chars_format::fixed, 3);
+			buf.append({digits, static_cast<std::size_t>(end - digits)});
+		}
+		else
+		{
+			buf << "null";
+		}
+		buf << "}\n";
+	}
+
+	static void footer(render_buffer&, std::size_t) {}
+};
+
+// 纯文件列表, 一行一个
+struct plain_format
+{
+	static constexpr std::string_view extension = ".txt";
+	static constexpr bool uses_media_info = false;
+	static constexpr bool absolute_paths = false;
+
+	static void header(render_buffer&, std::string_view, std::size_t) {}
+
+	static void entry(render_buffer& buf, const playlist_entry& e, std::size_t)
+	{
+		buf << e.path << "\n";
+	}
+
+	static void footer(render_buffer&, std::size_t) {}
+};
+
+template<typename Format, typename Entries>
+void render_playlist(render_buffer& buf, const Entries& entries, std::string_view title)
+{
+	auto count = std::size(entries);
+	Format::header(buf, title, count);
+	std::size_t index = 0;
+	for (const auto& e : entries)
+		Format::entry(buf, e, index++);
+	Format::footer(buf, count);
+}
+
+// 运行期的格式选择只在这里做一次, fn 以 Format 类型为模板参数被调用
+template<typename Fn>
+decltype(auto) with_playlist_format(playlist_format_id id, Fn&& fn)
+{
+	switch (id)
+	{
+		case playlist_format_id::pls: return fn.template operator()<pls_format>();
+		case playlist_format_id::xspf: return fn.template operator()<xspf_format>();
+		case playlist_format_id::jsonl: return fn.template operator()<jsonl_format>();
+		case playlist_format_id::plain: return fn.template operator()<plain_format>();
+		case playlist_format_id::m3u8: break;
+	}
+	return fn.template operator()<m3u8_format>();
+}
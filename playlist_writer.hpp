@@ -0,0 +1,128 @@
+﻿
+#pragma once
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <utility>
+
+// 播放列表先整个渲染到一块连续的内存里, 再一次性交给输出端.
+// 以前每一行都 std::endl, 每一行每个输出端都是一次 flush 一次 write 系统调用.
+//
+// 非 Windows 上内存直接向系统 mmap, 按页对齐, 长度是页的整数倍, 释放的时候 munmap.
+// 这样输出端可以用 vmsplice 把这些页原样挂到管道上 (见 output_sink), 不用再拷贝一遍;
+// munmap 以后管道里还引用着的页不会被别人拿去用. Linux 上扩容用 mremap, 也不用拷贝.
+class render_buffer
+{
+public:
+	render_buffer() = default;
+
+	explicit render_buffer(std::size_t reserve_size)
+	{
+		reserve(reserve_size);
+	}
+
+	render_buffer(render_buffer&& other) noexcept
+		: data_(std::exchange(other.data_, nullptr))
+		, size_(std::exchange(other.size_, 0))
+		, capacity_(std::exchange(other.capacity_, 0))
+	{}
+
+	render_buffer& operator=(render_buffer&& other) noexcept
+	{
+		std::swap(data_, other.data_);
+		std::swap(size_, other.size_);
+		std::swap(capacity_, other.capacity_);
+		return *this;
+	}
+
+	~render_buffer()
+	{
+		if (!data_)
+			return;
+#ifdef _WIN32
+		std::free(data_);
+#else
+		::munmap(data_, capacity_);
+#endif
+	}
+
+	void reserve(std::size_t new_capacity)
+	{
+		if (new_capacity <= capacity_)
+			return;
+#ifdef _WIN32
+		auto p = static_cast<char*>(std::realloc(data_, new_capacity));
+		if (!p)
+			throw std::bad_alloc{};
+#else
+		new_capacity = (new_capacity + page_size() - 1) / page_size() * page_size();
+		void* p = MAP_FAILED;
+#ifdef __linux__
+		if (data_)
+			p = ::mremap(data_, capacity_, new_capacity, MREMAP_MAYMOVE);
+		else
+#endif
+		{
+			p = ::mmap(nullptr, new_capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p != MAP_FAILED && data_)
+			{
+				std::memcpy(p, data_, size_);
+				::munmap(data_, capacity_);
+			}
+		}
+		if (p == MAP_FAILED)
+			throw std::bad_alloc{};
+#endif
+		data_ = static_cast<char*>(p);
+		capacity_ = new_capacity;
+	}
+
+	void append(std::string_view str)
+	{
+		if (size_ + str.size() > capacity_)
+			reserve(std::max(capacity_ * 2, size_ + str.size() + 4096));
+		std::memcpy(data_ + size_, str.data(), str.size());
+		size_ += str.size();
+	}
+
+	void push_back(char c)
+	{
+		append(std::string_view{&c, 1});
+	}
+
+	render_buffer& operator<<(std::string_view str)
+	{
+		append(str);
+		return *this;
+	}
+
+	void clear() { size_ = 0; }
+
+	const char* data() const { return data_; }
+	std::size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+	operator std::string_view() const { return {data_, size_}; }
+
+#ifndef _WIN32
+	static std::size_t page_size()
+	{
+		static const auto size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+		return size;
+	}
+#endif
+
+private:
+	char* data_ = nullptr;
+	std::size_t size_ = 0;
+	std::size_t capacity_ = 0;
+};
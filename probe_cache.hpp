@@ -0,0 +1,304 @@
+﻿
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "nowide/fstream.hpp"
+
+#include "hash_util.hpp"
+#include "mapped_file.hpp"
+#include "media_probe.hpp"
+
+// 视频头探测结果的持久缓存.
+// 用 (dev, inode, size, mtime) 认文件: 文件没动过, 时长分辨率编码就不会变, 热启动的时候一个视频文件都不用打开.
+//
+// 文件格式: 64 字节的头, 然后是 capacity 个定长 record 组成的开放寻址表 (线性探测, 按 dev+inode 的 hash 定位).
+// 整个文件共享映射进内存, 查找不需要读文件, 插入直接写映射.
+// 每条 record 自带校验, 写到一半被打断的 record 当作空槽位, 顶多是下次少命中一条; 查找的时候跳过它接着探测.
+// 表太挤或者文件格式不对的时候, 有效的 record 重新排成一张新表, 写到临时文件里再 rename 过去, 不会留下半张表.
+// 重建 (--rebuild-cache) 的时候查找总是不命中, 这次读到的文件都重新探测一遍, 替换掉各自的 record;
+// 别的目录的 record 原样保留, 最后整张表重排一次, 顺便清掉写坏的 record.
+struct probe_key
+{
+	std::uint64_t dev = 0;
+	std::uint64_t ino = 0;
+	std::uint64_t size = 0;
+	std::int64_t mtime_ns = 0;
+};
+
+class probe_cache
+{
+	struct header
+	{
+		char magic[8];
+		std::uint32_t record_size;
+		std::uint32_t capacity;
+		std::uint32_t count;
+		char reserved[44];
+	};
+	static_assert(sizeof(header) == 64);
+
+	struct record
+	{
+		probe_key key;
+		double duration;
+		std::uint32_t width;
+		std::uint32_t height;
+		std::array<char, 16> video_codec;
+		std::array<char, 16> audio_codec;
+		std::uint64_t check;
+	};
+	static_assert(sizeof(record) == 88);
+
+	static constexpr char magic[8] = {'C', 'P', 'L', 'P', 'R', 'B', '0', '1'};
+	static constexpr std::uint32_t min_capacity = 256;
+
+	static std::uint64_t record_check(const record& r)
+	{
+		// 0 留给空槽位
+		return hash64(&r, offsetof(record, check), 0x50524f42) | 1;
+	}
+
+	static bool is_valid(const record& r) { return r.check == record_check(r); }
+
+	// 从来没写过的槽位, 探测链到这里为止. 写到一半的 record 校验是 0 但是 key 不是 0, 不算
+	static bool is_unused(const record& r) { return r.check == 0 && r.key.dev == 0 && r.key.ino == 0; }
+
+	static std::uint64_t slot_hash(const probe_key& key)
+	{
+		std::uint64_t id[2] = {key.dev, key.ino};
+		return hash64(id, sizeof id, 0x494e4f44);
+	}
+
+	static bool same_file(const probe_key& a, const probe_key& b) { return a.dev == b.dev && a.ino == b.ino; }
+
+	static bool same_version(const probe_key& a, const probe_key& b)
+	{
+		return same_file(a, b) && a.size == b.size && a.mtime_ns == b.mtime_ns;
+	}
+
+public:
+	probe_cache() = default;
+
+	// rebuild 为 true 的时候 lookup 总是不命中, 这次 store 进来的结果替换掉旧的, 其余的保留, flush 的时候重排整张表
+	explicit probe_cache(std::filesystem::path cache_file, bool rebuild = false)
+		: cache_file_(std::move(cache_file))
+		, ignore_cached_(rebuild)
+	{
+		if (cache_file_.empty())
+			return;
+
+		map_ = mapped_file{cache_file_, mapped_file::access::read_write};
+		if (!map_.data())
+			return;
+		compact_ = rebuild;
+
+		auto h = table_header();
+		if (map_.size() < sizeof(header) || !std::equal(std::begin(magic), std::end(magic), h->magic)
+			|| h->record_size != sizeof(record) || !std::has_single_bit(h->capacity)
+			|| map_.size() != sizeof(header) + std::size_t{h->capacity} * sizeof(record))
+		{
+			// 不认识的格式或者长度不对, 当作没有缓存, flush 的时候重新创建
+			map_ = {};
+			need_rewrite_ = true;
+		}
+	}
+
+	probe_cache(const probe_cache&) = delete;
+	probe_cache& operator=(const probe_cache&) = delete;
+
+	~probe_cache()
+	{
+		flush();
+	}
+
+	bool enabled() const { return !cache_file_.empty(); }
+
+	bool lookup(const probe_key& key, media_info& info) const
+	{
+		if (ignore_cached_)
+			return false;
+
+		auto slot = find_slot(key);
+		if (!slot || !is_valid(*slot) || !same_version(slot->key, key))
+			return false;
+
+		info.duration = slot->duration;
+		info.width = slot->width;
+		info.height = slot->height;
+		info.video_codec = slot->video_codec;
+		info.audio_codec = slot->audio_codec;
+		return true;
+	}
+
+	void store(const probe_key& key, const media_info& info)
+	{
+		if (!enabled())
+			return;
+
+		record r{key, info.duration, info.width, info.height, info.video_codec, info.audio_codec, 0};
+		r.check = record_check(r);
+
+		// 表里有位置而且不会太挤, 直接写进映射; 否则留到 flush 的时候连同整张表一起重写
+		auto slot = need_rewrite_ ? nullptr : find_slot(key);
+		if (!slot)
+		{
+			pending_.push_back(r);
+			return;
+		}
+
+		bool is_new = !is_valid(*slot) || !same_file(slot->key, key);
+		auto h = table_header();
+		if (is_new && (std::uint64_t{h->count} + 1) * 4 > std::uint64_t{h->capacity} * 3)
+		{
+			pending_.push_back(r);
+			return;
+		}
+
+		// 先清掉校验再写内容, 最后写校验: 中途崩溃留下的只会是一条校验不过的 record
+		slot->check = 0;
+		std::memcpy(static_cast<void*>(slot), &r, offsetof(record, check));
+		slot->check = r.check;
+		if (is_new)
+			h->count++;
+	}
+
+	// 把放不进当前表的结果连同旧表一起写成一张新表
+	void flush()
+	{
+		if (!enabled() || (pending_.empty() && !need_rewrite_ && !compact_))
+			return;
+
+		std::vector<record> records;
+		if (map_.data() && !need_rewrite_)
+		{
+			auto [table, capacity] = table_records();
+			std::copy_if(table, table + capacity, std::back_inserter(records), is_valid);
+		}
+		// 旧表里的同一个文件 (以前的版本留下的重复) 留 mtime 新的; 这次 store 进来的总是最新的
+		auto from_table = records.size();
+		records.insert(records.end(), pending_.begin(), pending_.end());
+		pending_.clear();
+		need_rewrite_ = false;
+		compact_ = false;
+
+		// 负载因子保持在一半以下
+		auto capacity = std::max(min_capacity, std::bit_ceil(static_cast<std::uint32_t>(records.size() * 2 + 1)));
+		std::vector<record> table(capacity, record{});
+		std::uint32_t count = 0;
+		for (std::size_t n = 0; n < records.size(); n++)
+		{
+			auto& r = records[n];
+			auto mask = capacity - 1;
+			for (auto i = static_cast<std::uint32_t>(slot_hash(r.key)) & mask; ; i = (i + 1) & mask)
+			{
+				if (table[i].check == 0)
+				{
+					count++;
+					table[i] = r;
+					break;
+				}
+				if (same_file(table[i].key, r.key))
+				{
+					if (n >= from_table || r.key.mtime_ns >= table[i].key.mtime_ns)
+						table[i] = r;
+					break;
+				}
+			}
+		}
+
+		header h{};
+		std::copy(std::begin(magic), std::end(magic), h.magic);
+		h.record_size = sizeof(record);
+		h.capacity = capacity;
+		h.count = count;
+
+		// 先解除映射, Windows 上映射着的文件不能被替换
+		map_ = {};
+
+		auto tmp_file = cache_file_;
+		tmp_file += ".tmp";
+		{
+			nowide::ofstream out(tmp_file, std::ios::binary | std::ios::trunc);
+			if (!out)
+				return;
+			out.write(reinterpret_cast<const char*>(&h), sizeof h);
+			out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(record));
+			if (!out.flush())
+			{
+				out.close();
+				std::error_code ec;
+				std::filesystem::remove(tmp_file, ec);
+				return;
+			}
+		}
+
+		std::error_code ec;
+		std::filesystem::rename(tmp_file, cache_file_, ec);
+		if (ec)
+		{
+			std::filesystem::remove(tmp_file, ec);
+			return;
+		}
+
+		map_ = mapped_file{cache_file_, mapped_file::access::read_write};
+	}
+
+private:
+	header* table_header() const
+	{
+		return reinterpret_cast<header*>(const_cast<mapped_file&>(map_).writable_data());
+	}
+
+	std::pair<record*, std::uint32_t> table_records() const
+	{
+		auto h = table_header();
+		return {reinterpret_cast<record*>(reinterpret_cast<char*>(h) + sizeof(header)), h->capacity};
+	}
+
+	// 这个文件所在的槽位; 没有的话是可以放它的第一个空槽位 (包括校验不过的); 都没有返回 nullptr.
+	// 校验不过的槽位可能是写到一半的 record, 同一个文件可能在探测链更后面, 所以要一直找到从来没用过的槽位
+	record* find_slot(const probe_key& key) const
+	{
+		if (!map_.data())
+			return nullptr;
+
+		auto [table, capacity] = table_records();
+		auto mask = capacity - 1;
+		auto i = static_cast<std::uint32_t>(slot_hash(key)) & mask;
+		record* free_slot = nullptr;
+		for (std::uint32_t n = 0; n < capacity; n++, i = (i + 1) & mask)
+		{
+			if (is_valid(table[i]))
+			{
+				if (same_file(table[i].key, key))
+					return &table[i];
+				continue;
+			}
+			if (!free_slot)
+				free_slot = &table[i];
+			if (is_unused(table[i]))
+				break;
+		}
+		return free_slot;
+	}
+
+	std::filesystem::path cache_file_;
+	mapped_file map_;
+	std::vector<record> pending_;
+	bool need_rewrite_ = false;
+	bool ignore_cached_ = false;
+	// 旧表是好的, 但是 flush 的时候也要重排一次
+	bool compact_ = false;
+};
@@ -0,0 +1,133 @@
+﻿
+#pragma once
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "cancellation.hpp"
+#include "media_probe.hpp"
+#include "probe_cache.hpp"
+
+// 读视频文件头是延迟主导的, 机械硬盘和网络共享上尤其如此.
+// 这里把文件分给若干个线程并发去读, 并发数就是同时在途的 I/O 数.
+// 发起的顺序按 inode 号排, 让磁头尽量顺着走; 结果按原来的下标放回去, 输出顺序不变.
+// 每个文件先 stat 一次, 在 probe_cache 里命中的就不用打开了, 读出来的新结果最后统一写回缓存.
+// cancel 要求停下来的时候, 每个线程做完手上的文件就退出, 没读到的文件 info 保持默认值, 也不进缓存.
+struct probe_result
+{
+	media_info info;
+	// 这个文件花了多少微秒
+	float latency_us = 0;
+	// 结果来自 probe_cache
+	bool cached = false;
+	// stat 出来的文件信息, stat 失败 (或者在 Windows 上) 全是 0
+	probe_key key;
+};
+
+template<typename Paths>
+std::pmr::vector<probe_result> probe_all(const Paths& paths, unsigned jobs, probe_cache& cache, cancellation& cancel, std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+{
+	auto count = static_cast<std::uint32_t>(std::size(paths));
+	std::pmr::vector<probe_result> results(count, mr);
+	if (count == 0)
+		return results;
+
+	// 需要真正去读的文件, 按发起顺序
+	std::pmr::vector<std::uint32_t> issue_order(mr);
+	issue_order.reserve(count);
+
+#ifdef _WIN32
+	// Windows 上 stat 拿不到 inode, 不用缓存
+	for (std::uint32_t i = 0; i < count; i++)
+		issue_order.push_back(i);
+#else
+	for (std::uint32_t i = 0; i < count; i++)
+	{
+		if (i % 256 == 0 && cancel.poll())
+			return results;
+
+		struct stat st;
+		if (::stat(std::string{std::string_view{paths[i]}}.c_str(), &st) == 0)
+		{
+			auto& key = results[i].key;
+			key = {
+				static_cast<std::uint64_t>(st.st_dev),
+				static_cast<std::uint64_t>(st.st_ino),
+				static_cast<std::uint64_t>(st.st_size),
+				static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec,
+			};
+			if (cache.lookup(key, results[i].info))
+			{
+				results[i].cached = true;
+				continue;
+			}
+		}
+		issue_order.push_back(i);
+	}
+	std::ranges::stable_sort(issue_order, {}, [&](std::uint32_t i) { return results[i].key.ino; });
+#endif
+
+	auto pending = static_cast<std::uint32_t>(issue_order.size());
+	// 真正读完了的文件
+	std::pmr::vector<std::uint8_t> finished(count, 0, mr);
+
+	std::atomic<std::uint32_t> next{0};
+	auto worker = [&]
+	{
+		while (!cancel.poll())
+		{
+			auto k = next.fetch_add(1, std::memory_order_relaxed);
+			if (k >= pending)
+				break;
+
+			auto i = issue_order[k];
+			auto start = std::chrono::steady_clock::now();
+			results[i].info = probe_media(std::string_view{paths[i]});
+			results[i].latency_us = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count();
+			finished[i] = 1;
+		}
+	};
+
+	jobs = std::clamp<unsigned>(jobs, 1, std::max<std::uint32_t>(pending, 1));
+	{
+		std::vector<std::jthread> threads;
+		threads.reserve(jobs - 1);
+		for (unsigned t = 1; t < jobs; t++)
+			threads.emplace_back(worker);
+		// 当前线程也干活
+		worker();
+	}
+
+#ifndef _WIN32
+	// 读不到 stat 的文件 (key 全是 0) 不进缓存
+	for (auto i : issue_order)
+	{
+		if (finished[i] && results[i].key.ino != 0)
+			cache.store(results[i].key, results[i].info);
+	}
+	cache.flush();
+#endif
+
+	return results;
+}
+
+// 取第 p 百分位, latencies 会被重新排列
+inline float percentile(std::pmr::vector<float>& latencies, double p)
+{
+	if (latencies.empty())
+		return 0;
+	auto k = static_cast<std::size_t>(p / 100.0 * (latencies.size() - 1) + 0.5);
+	std::ranges::nth_element(latencies, latencies.begin() + k);
+	return latencies[k];
+}
@@ -0,0 +1,223 @@
+﻿
+#pragma once
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <vector>
+
+// 整个运行共用的 bump 分配器. 流水线上各个阶段的 pmr 容器都从这里分配, 单独一块块释放什么都不做,
+// 处理完一个目录 reset() 一次, 内存留着给下一个目录接着用.
+//
+// 内存按 chunk_size 大小的块直接向系统要. 块的大小是大页的整数倍:
+// 能拿到 MAP_HUGETLB 的大页就用, 拿不到就按大页对齐以后 madvise(MADV_HUGEPAGE) 让内核用透明大页.
+// 大于块大小 1/4 的分配单独要一块, reset 的时候还给系统.
+//
+// 不是线程安全的, 只在主线程上用.
+class run_arena : public std::pmr::memory_resource
+{
+public:
+	struct statistics
+	{
+		// 分配的次数, 整个运行累计
+		std::size_t allocations = 0;
+		// 当前已分配的字节数, reset 清零
+		std::size_t bytes = 0;
+		// bytes 的最大值
+		std::size_t peak_bytes = 0;
+		// 向系统要的字节数
+		std::size_t reserved_bytes = 0;
+		std::size_t chunks = 0;
+		// 其中是 MAP_HUGETLB 大页的块数
+		std::size_t huge_chunks = 0;
+	};
+
+	static constexpr std::size_t huge_page_size = 2 * 1024 * 1024;
+
+	explicit run_arena(bool use_huge_pages = true, std::size_t chunk_size = huge_page_size)
+		: chunk_size_((std::max(chunk_size, huge_page_size) + huge_page_size - 1) / huge_page_size * huge_page_size)
+		, use_huge_pages_(use_huge_pages)
+	{}
+
+	run_arena(const run_arena&) = delete;
+	run_arena& operator=(const run_arena&) = delete;
+
+	~run_arena()
+	{
+		for (auto& c : chunks_)
+			unmap_chunk(c);
+		for (auto& c : large_)
+			unmap_chunk(c);
+	}
+
+	// 之前分配出去的内存全部作废. 普通的块留着重用, 单独的大块还给系统
+	void reset()
+	{
+		for (auto& c : large_)
+		{
+			stats_.reserved_bytes -= c.size;
+			stats_.chunks--;
+			stats_.huge_chunks -= c.huge;
+			unmap_chunk(c);
+		}
+		large_.clear();
+
+		current_ = 0;
+		cursor_ = chunks_.empty() ? nullptr : chunks_[0].base;
+		end_ = chunks_.empty() ? nullptr : chunks_[0].base + chunks_[0].size;
+		stats_.bytes = 0;
+	}
+
+	const statistics& stats() const { return stats_; }
+
+private:
+	struct chunk
+	{
+		char* base;
+		std::size_t size;
+		bool huge;
+	};
+
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		stats_.allocations++;
+		stats_.bytes += bytes;
+		stats_.peak_bytes = std::max(stats_.peak_bytes, stats_.bytes);
+
+		if (auto p = bump(bytes, alignment))
+			return p;
+
+		if (bytes + alignment > chunk_size_ / 4)
+		{
+			auto size = (bytes + alignment + page_size() - 1) / page_size() * page_size();
+			large_.push_back(map_chunk(size, false));
+			return large_.back().base;
+		}
+
+		// 换到下一块, 以前 reset 留下来的块优先
+		if (chunks_.empty() || current_ + 1 >= chunks_.size())
+		{
+			chunks_.push_back(map_chunk(chunk_size_, use_huge_pages_));
+			current_ = chunks_.size() - 1;
+		}
+		else
+		{
+			current_++;
+		}
+		cursor_ = chunks_[current_].base;
+		end_ = cursor_ + chunks_[current_].size;
+		return bump(bytes, alignment);
+	}
+
+	void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+
+	void* bump(std::size_t bytes, std::size_t alignment)
+	{
+		if (!cursor_)
+			return nullptr;
+		auto aligned = (reinterpret_cast<std::uintptr_t>(cursor_) + alignment - 1) & ~(alignment - 1);
+		if (aligned + bytes > reinterpret_cast<std::uintptr_t>(end_))
+			return nullptr;
+		cursor_ = reinterpret_cast<char*>(aligned + bytes);
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	static std::size_t page_size()
+	{
+#ifdef _WIN32
+		return 4096;
+#else
+		static const auto size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+		return size;
+#endif
+	}
+
+	chunk map_chunk(std::size_t size, bool huge_pages)
+	{
+		chunk c{nullptr, size, false};
+#ifdef _WIN32
+		(void)huge_pages;
+		c.base = static_cast<char*>(VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+		if (!c.base)
+			throw std::bad_alloc{};
+#else
+#ifdef MAP_HUGETLB
+		// 大多数机器没有预留大页, 失败过一次就不再试了
+		static bool hugetlb_unavailable = false;
+		if (huge_pages && !hugetlb_unavailable)
+		{
+			auto p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (p != MAP_FAILED)
+			{
+				c.base = static_cast<char*>(p);
+				c.huge = true;
+			}
+			else
+			{
+				hugetlb_unavailable = true;
+			}
+		}
+#endif
+		if (!c.base && huge_pages)
+		{
+			// 多要一个大页, 把首尾不对齐的部分还回去, 剩下的按大页对齐
+			auto p = ::mmap(nullptr, size + huge_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+				throw std::bad_alloc{};
+			auto raw = static_cast<char*>(p);
+			auto aligned = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(raw) + huge_page_size - 1) & ~(huge_page_size - 1));
+			if (aligned != raw)
+				::munmap(raw, aligned - raw);
+			if (auto tail = raw + size + huge_page_size - (aligned + size); tail > 0)
+				::munmap(aligned + size, tail);
+			c.base = aligned;
+#ifdef MADV_HUGEPAGE
+			::madvise(c.base, size, MADV_HUGEPAGE);
+#endif
+		}
+		else if (!c.base)
+		{
+			auto p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+				throw std::bad_alloc{};
+			c.base = static_cast<char*>(p);
+		}
+#endif
+		stats_.reserved_bytes += size;
+		stats_.chunks++;
+		stats_.huge_chunks += c.huge;
+		return c;
+	}
+
+	static void unmap_chunk(chunk& c)
+	{
+#ifdef _WIN32
+		VirtualFree(c.base, 0, MEM_RELEASE);
+#else
+		::munmap(c.base, c.size);
+#endif
+	}
+
+	std::size_t chunk_size_;
+	bool use_huge_pages_;
+	std::vector<chunk> chunks_;
+	std::vector<chunk> large_;
+	std::size_t current_ = 0;
+	char* cursor_ = nullptr;
+	char* end_ = nullptr;
+	statistics stats_;
+};
@@ -0,0 +1,256 @@
+﻿
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "container_util.hpp"
+#include "hash_util.hpp"
+#include "string_pool.hpp"
+#include "tag_matcher.hpp"
+
+// 一个目录里混了好几部剧的时候, 先把文件按 "剧" 分组, 每组单独检测 第几集.
+//
+// 分组的依据是文件名的 "模板": 把所有的连续数字替换成一个占位符,
+// 比如 "[Grp] Show S01E03" 的模板是 "[Grp] Show S#E#",
+// 同一部剧的文件, 模板是一样的.
+// 数字后面的版本号和 parse_episode_variant 一样算作数字的一部分, "Show - 05v2" 和 "Show - 05" 的模板都是 "Show - #".
+// 输入是屏蔽了发布标签的文件名, 屏蔽掉的标签连同它前面的分隔符一起去掉, "Show.E03.720p" 和 "Show.E04" 的模板一样;
+// 括号里除了屏蔽的标签就只有分隔符的, 连括号和它前面的空格一起去掉, "Show - 03 [1080p]" 和 "Show - 04" 的模板一样.
+inline void name_template(std::string_view name, std::pmr::string& out)
+{
+	constexpr char placeholder = '#';
+	auto is_digit = [&](std::size_t i) { return i < name.size() && std::isdigit(static_cast<unsigned char>(name[i])); };
+	auto is_separator = [](char c) { return c == ' ' || c == '.' || c == '_' || c == '-'; };
+
+	// name[open] 是左括号的话, 返回只剩屏蔽字节和分隔符的括号的右括号位置, 否则返回 0
+	auto emptied_bracket = [&](std::size_t open) -> std::size_t
+	{
+		char close = name[open] == '[' ? ']' : name[open] == '(' ? ')' : '\0';
+		if (close == '\0')
+			return 0;
+		bool masked = false;
+		for (auto i = open + 1; i < name.size(); i++)
+		{
+			if (name[i] == close)
+				return masked ? i : 0;
+			if (name[i] == tag_matcher::mask_char)
+				masked = true;
+			else if (!is_separator(name[i]))
+				return 0;
+		}
+		return 0;
+	};
+
+	out.clear();
+	for (std::size_t i = 0; i < name.size(); i++)
+	{
+		char c = name[i];
+		if (auto close = emptied_bracket(i))
+		{
+			while (!out.empty() && is_separator(out.back()))
+				out.pop_back();
+			i = close;
+			continue;
+		}
+		if (c == tag_matcher::mask_char)
+		{
+			// 标签前面的分隔符一起去掉. 标签在最前面的话, 去掉的是后面的分隔符
+			while (!out.empty() && is_separator(out.back()))
+				out.pop_back();
+			while (i + 1 < name.size() && (name[i + 1] == tag_matcher::mask_char || (out.empty() && is_separator(name[i + 1]))))
+				i++;
+			continue;
+		}
+		if (is_digit(i))
+		{
+			while (is_digit(i + 1))
+				i++;
+			// 05v2
+			if (i + 1 < name.size() && (name[i + 1] == 'v' || name[i + 1] == 'V') && is_digit(i + 2))
+			{
+				i += 2;
+				while (is_digit(i + 1))
+					i++;
+			}
+			c = placeholder;
+		}
+		out.push_back(c);
+	}
+}
+
+// 返回每个文件所属的组号. 组号按照第一次出现的顺序编号,
+// 所以对排好序的输入, 组的顺序就是每部剧第一集出现的顺序.
+// 模板驻留在 pool 里, 同一个模板只比较一次字符串, 之后按编号分组;
+// pool 跨目录共用的话, 别的目录见过的模板也不用再存一份
+template<ContainerType Container>
+std::pmr::vector<std::uint32_t> cluster_by_template(const Container& names, string_pool& pool, std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+{
+	std::pmr::vector<std::uint32_t> cluster_of(mr);
+	cluster_of.reserve(std::size(names));
+
+	open_hash_index template_index(std::size(names), mr);
+	std::pmr::string name_tmpl(mr);
+
+	for (const auto& name : names)
+	{
+		name_template(std::string_view{name}, name_tmpl);
+		auto next_id = static_cast<std::uint32_t>(template_index.size());
+		auto [id, inserted] = template_index.try_emplace(pool.intern(name_tmpl), next_id);
+		cluster_of.push_back(id);
+	}
+
+	return cluster_of;
+}
+
+// 模板 hash 要求文件名除了数字以外一模一样, 字幕组中途改名就分不到一起了,
+// 比如 "[GroupA] Show - 03" 和 "Show.E04.[GroupB]".
+// 模糊模式用字符 n-gram 的 MinHash 签名估算两个文件名的相似度,
+// 再用 LSH 分段把签名相近的文件放进同一个桶, 每个文件只和桶里的代表比较,
+// 所以总的开销是线性的, 不需要两两比对.
+namespace minhash
+{
+	constexpr int ngram = 3;
+	constexpr int bands = 12;
+	constexpr int rows = 4;
+	constexpr int signature_size = bands * rows;
+
+	// 签名里相同的分量占多少才算同一部剧, 大约就是 n-gram 集合的 Jaccard 相似度
+	constexpr double similarity_threshold = 0.5;
+
+	using signature = std::array<std::uint64_t, signature_size>;
+
+	inline std::uint64_t permute(std::uint64_t h, int k)
+	{
+		h ^= 0x9E3779B97F4A7C15ull * static_cast<std::uint64_t>(k + 1);
+		h ^= h >> 32;
+		h *= 0xD6E8FEB86659FD93ull;
+		h ^= h >> 32;
+		return h;
+	}
+
+	// 只取字母参与 n-gram, 数字 (集数, 分辨率) 和标点都当作分隔符.
+	// 方括号里一般是字幕组之类的标签, 只要括号外面还有内容, 就不让它们参与.
+	inline signature make_signature(std::string_view name)
+	{
+		signature sig;
+		sig.fill(UINT64_MAX);
+
+		auto feed = [&](bool skip_brackets)
+		{
+			bool any = false;
+			int depth = 0;
+			char gram[ngram];
+			int gram_len = 0;
+
+			for (unsigned char c : name)
+			{
+				if (c == '[' || c == '(' || c == '{')
+					depth++;
+				else if ((c == ']' || c == ')' || c == '}') && depth > 0)
+					depth--;
+
+				bool is_letter = std::isalpha(c) || c >= 0x80;
+				if (!is_letter || (skip_brackets && depth > 0))
+				{
+					gram_len = 0;
+					continue;
+				}
+
+				if (gram_len == ngram)
+				{
+					std::memmove(gram, gram + 1, ngram - 1);
+					gram_len--;
+				}
+				gram[gram_len++] = static_cast<char>(std::tolower(c));
+
+				if (gram_len == ngram)
+				{
+					auto h = hash64(gram, ngram);
+					for (int k = 0; k < signature_size; k++)
+						sig[k] = std::min(sig[k], permute(h, k));
+					any = true;
+				}
+			}
+			return any;
+		};
+
+		if (!feed(true))
+			feed(false);
+
+		return sig;
+	}
+
+	inline double similarity(const signature& a, const signature& b)
+	{
+		int same = 0;
+		for (int k = 0; k < signature_size; k++)
+			same += a[k] == b[k];
+		return static_cast<double>(same) / signature_size;
+	}
+}
+
+template<ContainerType Container>
+std::pmr::vector<std::uint32_t> cluster_by_similarity(const Container& names, std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+{
+	auto count = static_cast<std::uint32_t>(std::size(names));
+
+	std::pmr::vector<minhash::signature> signatures(mr);
+	signatures.reserve(count);
+	for (const auto& name : names)
+		signatures.push_back(minhash::make_signature(name));
+
+	// 并查集, 总是把编号大的挂到编号小的下面, 这样根就是组里最靠前的文件
+	std::pmr::vector<std::uint32_t> parent(count, 0, mr);
+	for (std::uint32_t i = 0; i < count; i++)
+		parent[i] = i;
+
+	auto find_root = [&](std::uint32_t i)
+	{
+		while (parent[i] != i)
+		{
+			parent[i] = parent[parent[i]];
+			i = parent[i];
+		}
+		return i;
+	};
+
+	for (int band = 0; band < minhash::bands; band++)
+	{
+		open_hash_index buckets(count, mr);
+		for (std::uint32_t i = 0; i < count; i++)
+		{
+			auto band_key = hash64(&signatures[i][band * minhash::rows], sizeof(std::uint64_t) * minhash::rows, band);
+			auto [representative, inserted] = buckets.try_emplace(band_key, i);
+			if (inserted)
+				continue;
+
+			if (minhash::similarity(signatures[i], signatures[representative]) < minhash::similarity_threshold)
+				continue;
+
+			auto a = find_root(i);
+			auto b = find_root(representative);
+			if (a != b)
+				parent[std::max(a, b)] = std::min(a, b);
+		}
+	}
+
+	std::pmr::vector<std::uint32_t> cluster_of(mr);
+	cluster_of.reserve(count);
+	open_hash_index cluster_index(count, mr);
+	for (std::uint32_t i = 0; i < count; i++)
+	{
+		auto next_id = static_cast<std::uint32_t>(cluster_index.size());
+		auto [id, inserted] = cluster_index.try_emplace(find_root(i), next_id);
+		cluster_of.push_back(id);
+	}
+	return cluster_of;
+}
@@ -0,0 +1,104 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+
+#include "hash_util.hpp"
+
+// 字符串驻留池: 同样内容的字符串只存一份, 每份有一个 32 位的编号.
+// 分组的时候文件名模板驻留以后, 比较和 hash 都只是比较编号, 跨目录也是同一个编号.
+//
+// 只在主线程上用, 不加锁. 字符串存在池自己的内存里, 池活着的时候 view() 返回的 string_view 一直有效.
+class string_pool
+{
+public:
+	using id_type = std::uint32_t;
+
+	// 池里的东西要跨越多个目录, 不要用每个目录都 reset 的 arena
+	explicit string_pool(std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+		: chars_(upstream)
+		, strings_(upstream)
+		, slots_(16, slot{0, 0}, upstream)
+	{}
+
+	string_pool(const string_pool&) = delete;
+	string_pool& operator=(const string_pool&) = delete;
+
+	// 返回 str 的编号, 第一次见到的时候复制一份进池子
+	id_type intern(std::string_view str)
+	{
+		auto h = hash64(str, 0x53545250);
+		// 0 留给空槽位
+		auto tag = static_cast<std::uint32_t>(h >> 32) | 1;
+
+		auto mask = slots_.size() - 1;
+		for (auto i = static_cast<std::size_t>(h) & mask; ; i = (i + 1) & mask)
+		{
+			auto& s = slots_[i];
+			if (s.hash_tag == 0)
+				break;
+			if (s.hash_tag == tag && strings_[s.id] == str)
+				return s.id;
+		}
+
+		auto id = static_cast<id_type>(strings_.size());
+		auto chars = static_cast<char*>(chars_.allocate(str.size() + 1, 1));
+		std::memcpy(chars, str.data(), str.size());
+		chars[str.size()] = '\0';
+		strings_.emplace_back(chars, str.size());
+
+		if (strings_.size() * 2 > slots_.size())
+			grow();
+		insert_slot({tag, id}, h);
+		return id;
+	}
+
+	std::string_view view(id_type id) const
+	{
+		return strings_[id];
+	}
+
+	// 驻留过的字符串个数
+	std::size_t size() const
+	{
+		return strings_.size();
+	}
+
+private:
+	struct slot
+	{
+		// 0 表示空槽位
+		std::uint32_t hash_tag;
+		id_type id;
+	};
+
+	void insert_slot(slot s, std::uint64_t h)
+	{
+		auto mask = slots_.size() - 1;
+		auto i = static_cast<std::size_t>(h) & mask;
+		while (slots_[i].hash_tag != 0)
+			i = (i + 1) & mask;
+		slots_[i] = s;
+	}
+
+	void grow()
+	{
+		std::pmr::vector<slot> old(slots_.size() * 2, slot{0, 0}, slots_.get_allocator());
+		old.swap(slots_);
+		for (auto& s : old)
+		{
+			if (s.hash_tag != 0)
+				insert_slot(s, hash64(strings_[s.id], 0x53545250));
+		}
+	}
+
+	// 字符串本身, 一直到池销毁才释放
+	std::pmr::monotonic_buffer_resource chars_;
+	// 编号 -> 字符串. vector 扩容只搬 string_view, 字符还在 chars_ 里不动
+	std::pmr::vector<std::string_view> strings_;
+	std::pmr::vector<slot> slots_;
+};
@@ -0,0 +1,300 @@
+﻿
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory_resource>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nowide/fstream.hpp"
+
+// 文件名里的 1080p, x265, HEVC, WEB-DL, [ABCD1234] 之类的发布标签,
+// 对自然排序和 第几集 检测来说都是干扰.
+//
+// tag_matcher 在启动的时候用标签字典构造一棵 trie, 之后每个文件名只需要扫描一遍, 就能找出所有的标签所在的区间.
+// 输入字节先映射成字符类别 (大小写映射成同一个类别), trie 的每一步只是一次查表.
+//
+// 标签只认前后都是单词边界 (不是字母和数字) 的, 所以标签只可能从一个单词的开头开始.
+// 这里没有用 Aho-Corasick 的失配转移在每个字节上推进状态机: 那样每个字节的查表都依赖上一个字节的结果,
+// 速度被访存延迟卡死 (一个字节要好几个时钟周期). 现在只在单词开头从 trie 的根往下走, 走不下去就停,
+// 单词中间的字节只查一次 "是不是字母数字", 互相之间没有依赖.
+// 文件名里的单词大多数第一两个字节就走不下去了, 所以绝大部分字节只是在找下一个单词的开头.
+class tag_matcher
+{
+public:
+	struct span
+	{
+		std::uint32_t begin;
+		std::uint32_t length;
+
+		std::uint32_t end() const { return begin + length; }
+	};
+
+	// 被屏蔽的标签, 用这个字节填充, 保持文件名长度不变, 这样 第几集 的下标依然有效
+	static constexpr char mask_char = '\x01';
+
+	static std::vector<std::string> default_tags()
+	{
+		return {
+			"4320p", "2160p", "1440p", "1080p", "1080i", "720p", "576p", "480p", "360p", "4k", "8k",
+			"x264", "x265", "h264", "h265", "h.264", "h.265", "hevc", "avc", "av1", "vp9",
+			"8bit", "10bit", "hi10p", "hdr", "hdr10", "hdr10+", "dv", "sdr",
+			"web-dl", "webdl", "web-rip", "webrip", "web", "bdrip", "bd-rip", "brrip", "bluray", "blu-ray",
+			"bdremux", "remux", "dvdrip", "hdtv", "hdrip", "tvrip",
+			"aac", "aac2.0", "ac3", "eac3", "flac", "dts", "dts-hd", "truehd", "atmos", "opus",
+			"ddp5.1", "dd5.1", "ddp2.0", "5.1", "7.1", "2.0",
+			"proper", "repack", "uncensored", "uncut",
+			"amzn", "nf", "dsnp", "hmax", "baha", "b-global", "cr",
+			"chs", "cht", "gb", "big5", "jpsc", "jptc", "multi-subs",
+		};
+	}
+
+	// 读取用户自己的标签字典, 一行一个标签, # 开头的是注释
+	static void load_tag_file(const std::filesystem::path& file, std::vector<std::string>& tags)
+	{
+		nowide::ifstream in(file);
+		std::string line;
+		while (std::getline(in, line))
+		{
+			while (!line.empty() && std::isspace(static_cast<unsigned char>(line.back())))
+				line.pop_back();
+			auto first = line.find_first_not_of(" \t");
+			if (first == std::string::npos || line[first] == '#')
+				continue;
+			tags.push_back(line.substr(first));
+		}
+	}
+
+	tag_matcher()
+		: tag_matcher(default_tags())
+	{}
+
+	explicit tag_matcher(const std::vector<std::string>& tags)
+	{
+		build(tags);
+	}
+
+	// 找出文件名里所有的标签, 结果按位置排好, 互相重叠的已经合并
+	void scan(std::string_view name, std::pmr::vector<span>& spans) const
+	{
+		spans.clear();
+
+		for (std::size_t i = 0; i < name.size(); i++)
+		{
+			// name[i] 是一个单词的开头, 或者是单词之间的字节.
+			// 大部分单词头两个字节就对不上任何标签, 先查一下, 这个分支基本上都能预测对
+			if (name[i] == '[')
+				match_crc(name, i, spans);
+			auto second = i + 1 < name.size() ? byte_class_[static_cast<unsigned char>(name[i + 1])] : 0;
+			if (tag_prefix_[byte_class_[static_cast<unsigned char>(name[i])] * class_count_ + second])
+				match_at(name, i, spans);
+
+			// 下一个可能的开头在下一个不是字母数字的字节后面.
+			// 紧跟在单词后面的 '[' 不会是标签的开头, 但是 CRC 校验码不要求前面是单词边界
+			auto word_end = i;
+			while (word_end < name.size() && is_word_byte(name[word_end]))
+				word_end++;
+			if (word_end != i && word_end < name.size() && name[word_end] == '[')
+				match_crc(name, word_end, spans);
+			i = word_end;
+		}
+	}
+
+	// 扫描多个文件名, on_scanned(index, spans) 对每个文件名调用一次
+	template<typename Strings, typename Callback>
+	void scan_all(const Strings& names, Callback&& on_scanned, std::pmr::memory_resource* mr = std::pmr::get_default_resource()) const
+	{
+		std::pmr::vector<span> spans(mr);
+		std::size_t index = 0;
+		for (const auto& name : names)
+		{
+			scan(std::string_view{name}, spans);
+			on_scanned(index++, spans);
+		}
+	}
+
+	// 把所有文件名里的标签原地替换成 mask_char
+	template<typename Strings>
+	void mask_all(Strings& names, std::pmr::memory_resource* mr = std::pmr::get_default_resource()) const
+	{
+		scan_all(names, [&](std::size_t i, const std::pmr::vector<span>& spans)
+		{
+			for (auto s : spans)
+				std::fill_n(names[i].begin() + s.begin, s.length, mask_char);
+		}, mr);
+	}
+
+	// 去掉标签, 以及去掉标签以后留下的空括号和多余的分隔符, 用来当作标题显示
+	static std::string strip_tags(std::string_view name, std::span<const span> spans)
+	{
+		std::string title;
+		title.reserve(name.size());
+
+		std::size_t pos = 0;
+		for (auto s : spans)
+		{
+			title.append(name.substr(pos, s.begin - pos));
+			title.push_back(' ');
+			pos = s.end();
+		}
+		title.append(name.substr(pos));
+
+		// 清理 "[]", "()", 以及连续的分隔符
+		std::string cleaned;
+		cleaned.reserve(title.size());
+		for (std::size_t i = 0; i < title.size(); i++)
+		{
+			char c = title[i];
+			if (c == '[' || c == '(')
+			{
+				auto close = title.find(c == '[' ? ']' : ')', i + 1);
+				if (close != std::string::npos && title.find_first_not_of(" ._-", i + 1) == close)
+				{
+					i = close;
+					continue;
+				}
+			}
+
+			bool is_sep = c == ' ' || c == '.' || c == '_';
+			if (is_sep)
+			{
+				if (!cleaned.empty() && cleaned.back() != ' ')
+					cleaned.push_back(' ');
+				continue;
+			}
+			cleaned.push_back(c);
+		}
+
+		while (!cleaned.empty() && (cleaned.back() == ' ' || cleaned.back() == '-'))
+			cleaned.pop_back();
+		return cleaned;
+	}
+
+private:
+	static void push_span(std::pmr::vector<span>& spans, std::uint32_t begin, std::uint32_t end)
+	{
+		while (!spans.empty() && begin <= spans.back().end())
+		{
+			begin = std::min(begin, spans.back().begin);
+			end = std::max(end, spans.back().end());
+			spans.pop_back();
+		}
+		spans.push_back({begin, end - begin});
+	}
+
+	static constexpr auto word_bytes = []
+	{
+		std::array<bool, 256> table{};
+		for (int c = 0; c < 256; c++)
+			table[c] = (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z');
+		return table;
+	}();
+
+	static bool is_word_byte(char c)
+	{
+		return word_bytes[static_cast<unsigned char>(c)];
+	}
+
+	// name[begin] 是 '[', 看看是不是 [ABCD1234] 这样的 CRC32 校验码
+	static void match_crc(std::string_view name, std::size_t begin, std::pmr::vector<span>& spans)
+	{
+		if (begin + 9 >= name.size() || name[begin + 9] != ']')
+			return;
+		for (auto j = begin + 1; j < begin + 9; j++)
+		{
+			if (!std::isxdigit(static_cast<unsigned char>(name[j])))
+				return;
+		}
+		push_span(spans, static_cast<std::uint32_t>(begin), static_cast<std::uint32_t>(begin + 10));
+	}
+
+	// 从 name[begin] 开始往下走 trie, 记下最长的一个后面是单词边界的标签
+	void match_at(std::string_view name, std::size_t begin, std::pmr::vector<span>& spans) const
+	{
+		std::size_t end = 0;
+		std::uint32_t node = 0;
+		for (auto i = begin; i < name.size(); i++)
+		{
+			// 类别 0 的字节不在任何标签里, 这一列全是 0
+			auto next = trie_[node + byte_class_[static_cast<unsigned char>(name[i])]];
+			if (next == 0)
+				break;
+			node = next >> 1;
+			if ((next & 1) && (i + 1 == name.size() || !is_word_byte(name[i + 1])))
+				end = i + 1;
+		}
+		if (end != 0)
+			push_span(spans, static_cast<std::uint32_t>(begin), static_cast<std::uint32_t>(end));
+	}
+
+	void build(const std::vector<std::string>& tags)
+	{
+		auto fold = [](unsigned char c) { return static_cast<unsigned char>(std::tolower(c)); };
+
+		// 字符类别: 0 表示不在任何标签里出现的字节
+		byte_class_.fill(0);
+		class_count_ = 1;
+		for (const auto& tag : tags)
+		{
+			for (unsigned char c : tag)
+			{
+				auto lc = fold(c);
+				if (byte_class_[lc] == 0)
+				{
+					byte_class_[lc] = static_cast<std::uint8_t>(class_count_++);
+					byte_class_[std::toupper(lc)] = byte_class_[lc];
+				}
+			}
+		}
+
+		// trie 里存的是 子节点的行偏移 (节点编号 * class_count_) * 2 + 子节点是不是一个标签的结尾,
+		// 0 表示没有子节点
+		trie_.assign(class_count_, 0);
+		for (const auto& tag : tags)
+		{
+			if (tag.empty())
+				continue;
+
+			std::uint32_t node = 0;
+			std::uint32_t* edge = nullptr;
+			for (unsigned char c : tag)
+			{
+				auto index = node + byte_class_[c];
+				if (trie_[index] == 0)
+				{
+					trie_[index] = static_cast<std::uint32_t>(trie_.size()) << 1;
+					trie_.resize(trie_.size() + class_count_, 0);
+				}
+				edge = &trie_[index];
+				node = *edge >> 1;
+			}
+			*edge |= 1;
+		}
+
+		// 标签的头两个字节的类别. 只有一个字节的标签, 后面跟什么都算
+		tag_prefix_.assign(class_count_ * class_count_, false);
+		for (const auto& tag : tags)
+		{
+			if (tag.empty())
+				continue;
+			auto first = byte_class_[static_cast<unsigned char>(tag[0])] * class_count_;
+			if (tag.size() == 1)
+				std::fill_n(tag_prefix_.begin() + first, class_count_, true);
+			else
+				tag_prefix_[first + byte_class_[static_cast<unsigned char>(tag[1])]] = true;
+		}
+	}
+
+	std::array<std::uint8_t, 256> byte_class_;
+	std::size_t class_count_ = 1;
+	std::vector<std::uint32_t> trie_;
+	std::vector<std::uint8_t> tag_prefix_;
+};
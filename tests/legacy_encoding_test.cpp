@@ -0,0 +1,76 @@
+// Release 构建也要检查
+#undef NDEBUG
+#include <cassert>
+#include <memory_resource>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "legacy_encoding.hpp"
+
+struct fixture
+{
+	// 压缩包里的原始字节
+	std::string_view bytes;
+	// 转换以后应该得到的 UTF-8
+	std::string_view utf8;
+};
+
+// 同一个目录里的文件名, 字节是用 Python 的 str.encode("gbk") / str.encode("big5") 生成的
+static const fixture gbk_names[] = {
+	{"[\x97@\xB6\xBC\xD7\xD6\xC4\xBB\xD7\xE9] \xBD\xF8\xBB\xF7\xB5\xC4\xBE\xDE\xC8\xCB \xB5\xDA" "01\xBB\xB0 [1080p].mkv", "[桜都字幕组] 进击的巨人 第01话 [1080p].mkv"},
+	{"[\x97@\xB6\xBC\xD7\xD6\xC4\xBB\xD7\xE9] \xBD\xF8\xBB\xF7\xB5\xC4\xBE\xDE\xC8\xCB \xB5\xDA" "02\xBB\xB0 [1080p].mkv", "[桜都字幕组] 进击的巨人 第02话 [1080p].mkv"},
+	{"\xB9\xED\xC3\xF0\xD6\xAE\xC8\xD0 - 03.mp4", "鬼灭之刃 - 03.mp4"},
+	{"\xBC\xE4\xB5\xFD\xB9\xFD\xBC\xD2\xBC\xD2 \xB5\xDA" "12\xBC\xAF.mkv", "间谍过家家 第12集.mkv"},
+};
+
+static const fixture big5_names[] = {
+	{"[\xA6r\xB9\xF5\xB2\xD5] \xB6i\xC0\xBB\xAA\xBA\xA5\xA8\xA4H \xB2\xC4" "01\xB8\xDC [1080p].mkv", "[字幕組] 進擊的巨人 第01話 [1080p].mkv"},
+	{"[\xA6r\xB9\xF5\xB2\xD5] \xB6i\xC0\xBB\xAA\xBA\xA5\xA8\xA4H \xB2\xC4" "02\xB8\xDC [1080p].mkv", "[字幕組] 進擊的巨人 第02話 [1080p].mkv"},
+	{"\xB0\xAD\xB7\xC0\xA4\xA7\xA4" "b - 03.mp4", "鬼滅之刃 - 03.mp4"},
+	{"\xB6\xA1\xBF\xD2\xAE" "a\xAE" "a\xB0s \xB2\xC4" "12\xB6\xB0.mkv", "間諜家家酒 第12集.mkv"},
+};
+
+// 整个目录一起打分
+static legacy::encoding detect(std::span<const fixture> names)
+{
+	legacy::detector detector;
+	for (auto& name : names)
+		detector.add(name.bytes);
+	return detector.best();
+}
+
+static void check_transcoding(legacy::encoding e, std::span<const fixture> names)
+{
+	std::pmr::string out;
+	for (auto& name : names)
+	{
+		assert(!utf8::validate(name.bytes.data(), name.bytes.size()));
+		assert(legacy::to_utf8(e, name.bytes, out));
+		assert(out == name.utf8);
+	}
+}
+
+int main()
+{
+	assert(detect(gbk_names) == legacy::encoding::gbk);
+	assert(detect(big5_names) == legacy::encoding::big5);
+
+	check_transcoding(legacy::encoding::gbk, gbk_names);
+	check_transcoding(legacy::encoding::big5, big5_names);
+
+	// 只有一个文件名的目录也能认出来
+	for (auto& name : gbk_names)
+		assert(detect({&name, 1}) == legacy::encoding::gbk);
+	for (auto& name : big5_names)
+		assert(detect({&name, 1}) == legacy::encoding::big5);
+
+	// 截断的双字节字符, 不在表里的序列
+	std::pmr::string out;
+	assert(!legacy::to_utf8(legacy::encoding::gbk, "\xB5", out));
+	assert(!legacy::to_utf8(legacy::encoding::big5, "\xA4", out));
+	assert(!legacy::to_utf8(legacy::encoding::big5, "\x80\x40", out));
+	// 全是 ASCII 的原样
+	assert(legacy::to_utf8(legacy::encoding::gbk, "Show - 01.mkv", out) && out == "Show - 01.mkv");
+	return 0;
+}
@@ -0,0 +1,100 @@
+// Release 构建也要检查
+#undef NDEBUG
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+
+#include "dedupe.hpp"
+#include "file_table.hpp"
+#include "series_cluster.hpp"
+#include "tag_matcher.hpp"
+
+static const tag_matcher tags;
+
+static file_table make_table(std::initializer_list<std::string_view> paths)
+{
+	file_table table;
+	for (auto path : paths)
+		table.add(path);
+	table.build_keys(tags);
+	return table;
+}
+
+// 和 main.cpp 一样: 文件名进文件表, 屏蔽发布标签, 用屏蔽后的 stem 按模板分组
+static std::pmr::vector<std::uint32_t> cluster(const file_table& table)
+{
+	std::vector<std::string_view> masked_names;
+	for (std::uint32_t row = 0; row < table.size(); row++)
+		masked_names.push_back(table.masked_stem(row));
+
+	string_pool pool;
+	return cluster_by_template(masked_names, pool);
+}
+
+static std::pmr::vector<std::uint32_t> cluster(std::initializer_list<std::string_view> paths)
+{
+	return cluster(make_table(paths));
+}
+
+// 分好组以后每组单独去重, 返回留下来的行号. 这里的文件名 第几集 都在 digi_for_episode 这个位置
+static std::vector<std::uint32_t> dedupe(std::initializer_list<std::string_view> paths, int digi_for_episode)
+{
+	auto table = make_table(paths);
+	auto cluster_of = cluster(table);
+
+	std::vector<std::uint32_t> kept;
+	for (std::uint32_t c = 0; c <= *std::ranges::max_element(cluster_of); c++)
+	{
+		std::vector<std::uint32_t> rows;
+		std::vector<std::string_view> stems;
+		for (std::uint32_t row = 0; row < table.size(); row++)
+		{
+			if (cluster_of[row] == c)
+			{
+				rows.push_back(row);
+				stems.push_back(table.stem(row));
+			}
+		}
+		auto tag_spans = [&](std::uint32_t i) { return table.tag_spans(rows[i]); };
+		for (auto i : dedupe_best_variant(stems, tag_spans, digi_for_episode, [](std::uint32_t) { return 0; }))
+			kept.push_back(rows[i]);
+	}
+	std::ranges::sort(kept);
+	return kept;
+}
+
+int main()
+{
+	// 屏蔽以后 720p 和 1080p 的长度不一样, 模板还是要一样
+	auto c = cluster({"Show.E04.mkv", "Show.E05.720p.mkv", "Show.E05.1080p.mkv", "Show.E06.mkv"});
+	assert(c[0] == c[1] && c[1] == c[2] && c[2] == c[3]);
+
+	// 没有括号的标签连同前面的分隔符一起去掉
+	c = cluster({"Show.E01.720p.mkv", "Show.E02.mkv", "Show.E03.x265.1080p.mkv", "Show - E04 - 720p.mkv"});
+	assert(c[0] == c[1] && c[1] == c[2] && c[0] != c[3]);
+
+	// 只剩标签的括号和没有括号的一样
+	c = cluster({"[Grp] Show - 03 [1080p].mkv", "[Grp] Show - 04.mkv", "[Grp] Show - 05 [720p x265].mkv"});
+	assert(c[0] == c[1] && c[1] == c[2]);
+
+	// 版本号
+	c = cluster({"Show - 04.mkv", "Show - 05.mkv", "Show - 05v2.mkv"});
+	assert(c[0] == c[1] && c[1] == c[2]);
+
+	// 不同的剧还是要分开, 括号里有别的内容的也不去掉
+	c = cluster({"Show.E01.720p.mkv", "Other.E01.720p.mkv", "Show [Extra].E02.mkv"});
+	assert(c[0] != c[1] && c[0] != c[2] && c[1] != c[2]);
+
+	// 同一集的几个版本只留分辨率最高的
+	auto kept = dedupe({"Show.E01.720p.mkv", "Show.E01.mkv", "Show.E01.1080p.mkv", "Show.E02.mkv"}, 6);
+	assert((kept == std::vector<std::uint32_t>{2, 3}));
+
+	// 一个目录里的两部剧, 同样的集数不是同一集的两个版本
+	kept = dedupe({"A - 01.mkv", "A - 02.mkv", "B - 01.mkv", "B - 02.mkv", "A - 02 [1080p].mkv"}, 4);
+	assert((kept == std::vector<std::uint32_t>{0, 2, 3, 4}));
+
+	return 0;
+}
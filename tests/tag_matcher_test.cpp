@@ -0,0 +1,75 @@
+// Release 构建也要检查
+#undef NDEBUG
+#include <cassert>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "tag_matcher.hpp"
+
+static const tag_matcher tags;
+
+// 标签原样取出来, 用 | 隔开
+static std::string found(std::string_view name, const tag_matcher& matcher = tags)
+{
+	std::pmr::vector<tag_matcher::span> spans;
+	matcher.scan(name, spans);
+	std::string out;
+	for (auto s : spans)
+	{
+		if (!out.empty())
+			out += '|';
+		out += name.substr(s.begin, s.length);
+	}
+	return out;
+}
+
+int main()
+{
+	// 短标签只在单词边界上算
+	assert(found("Show.DV.NF.WEB-DL") == "DV|NF|WEB-DL");
+	assert(found("Dvd Nfl Cry Crab") == "");
+	assert(found("Advance.Conf.Accra") == "");
+	assert(found("[CR] Show - 01") == "CR");
+	assert(found("Show - 01 (nf)") == "nf");
+
+	// 带点的标签, 前后都是数字的时候不能从中间截
+	assert(found("Show.E01.5.1.mkv") == "5.1");
+	assert(found("Show.E01.15.1") == "");
+	assert(found("Show.E01.5.10") == "");
+	assert(found("Show DDP5.1 H.264") == "DDP5.1|H.264");
+
+	// 大小写不敏感
+	assert(found("show.1080P.Hevc.x265") == "1080P|Hevc|x265");
+	assert(found("SHOW.WEBRIP.AAC") == "WEBRIP|AAC");
+
+	// 最长的那个: hdr10 和 hdr 都在字典里
+	assert(found("Show HDR10 x") == "HDR10");
+	// 连在一起的几个标签各算各的, 重叠的合并
+	assert(found("[1080p][HEVC]") == "1080p|HEVC");
+
+	// CRC 校验码: 正好 8 个十六进制数字
+	assert(found("Show - 01 [ABCD1234].mkv") == "[ABCD1234]");
+	assert(found("Show - 01[abcd1234]") == "[abcd1234]");
+	assert(found("Show - 01 [ABCD123]") == "");
+	assert(found("Show - 01 [ABCD123G]") == "");
+	assert(found("[ABCD1234") == "");
+
+	// UTF-8 的字节也算单词边界
+	assert(found("第01话 1080p") == "1080p");
+	assert(found("第01话1080p") == "1080p");
+
+	// 用户自己的标签
+	tag_matcher custom{{"gb", "my-group", "x"}};
+	assert(found("Show.My-Group.GB.x.mkv", custom) == "My-Group|GB|x");
+	assert(found("Show.my-groups.gbx", custom) == "");
+
+	// 去掉标签以后的标题
+	std::string_view name = "[Grp] Show - 05 [1080p][HEVC][ABCD1234]";
+	std::pmr::vector<tag_matcher::span> spans;
+	tags.scan(name, spans);
+	assert(tag_matcher::strip_tags(name, spans) == "[Grp] Show - 05");
+
+	return 0;
+}
@@ -0,0 +1,59 @@
+// Release 构建也要检查
+#undef NDEBUG
+#include <cassert>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+#include "generic_string.hpp"
+
+// 规范化以后的名字
+static std::string nfc_of(std::string_view name)
+{
+	std::pmr::string scratch;
+	return std::string(to_nfc(name, scratch));
+}
+
+// 已经是 NFC 的名字原样返回, 不复制
+static bool unchanged(std::string_view name)
+{
+	std::pmr::string scratch;
+	return to_nfc(name, scratch).data() == name.data() && scratch.empty();
+}
+
+int main()
+{
+	// 本来就是 NFC 的, 包括组合好的字符和不需要组合的中日韩文字
+	assert(unchanged("[Grp] Show - 01 [1080p].mkv"));
+	assert(unchanged("Café - 第01话.mkv"));
+	assert(unchanged("ポケモン 한글.mp4"));
+	assert(unchanged(""));
+
+	// Mac 上的 NFD 文件名: 拉丁, 希腊, 西里尔字母加附加符号
+	assert(nfc_of("Café.mkv") == "Café.mkv");
+	assert(nfc_of("ά") == "ά");
+	assert(nfc_of("й") == "й");
+
+	// 假名的浊音和半浊音
+	assert(nfc_of("が") == "が");
+	assert(nfc_of("ポケモン - 01.mkv") == "ポケモン - 01.mkv");
+
+	// 韩文字母按公式组合成音节
+	assert(nfc_of("각") == "각");
+	assert(nfc_of("한글") == "한글");
+
+	// 附加符号按组合类重新排序以后再组合
+	assert(nfc_of("ậ") == "ậ");
+	assert(nfc_of("ậ") == "ậ");
+
+	// 被挡住的附加符号留着: ä 和 U+0301 没有组合形式
+	assert(nfc_of("ä́") == "ä́");
+	assert(nfc_of("é́") == "é́");
+
+	// 规范化以后和原来一样的 (组合好的字符后面跟着不能组合的符号)
+	assert(unchanged("ä́"));
+
+	// 不是合法 UTF-8 的名字原样保留
+	assert(unchanged("\xFF" "é"));
+	return 0;
+}
@@ -0,0 +1,134 @@
+// Release 构建也要检查
+#undef NDEBUG
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "utf8_codec.hpp"
+
+// 随机的输入: 大部分是 ASCII 和 3 字节的中日韩文字, 夹杂 2/4 字节的字符, 截断的序列和随便的字节,
+// 让向量化的路径在块的中间和边上都碰到各种情况
+static std::string random_utf8(std::mt19937& rng)
+{
+	static const char* const pieces[] = {"a", "Show - ", "01", " [1080p]", ".mkv", "第", "话", "進撃の巨人", "ー",
+		"é", "ñ", "Ω", "😀", "\xEF\xBF\xBD", "\xE4\xB8", "\xF0\x9F\x98", "\xC0\xAF", "\xED\xA0\x80", "\xF4\x90\x80\x80", "\x80", "\xFF"};
+	std::string s;
+	auto count = rng() % 40;
+	for (std::size_t i = 0; i < count; i++)
+	{
+		if (rng() % 8 == 0)
+			s += static_cast<char>(rng());
+		else
+			s += pieces[rng() % std::size(pieces)];
+	}
+	return s;
+}
+
+static std::u32string decode_with(std::size_t (*decode)(const char*, std::size_t, char32_t*), const std::string& s)
+{
+	// 向量化的路径会多写, 但不会超出 n 个位置
+	std::u32string out(s.size() + 1, U'\0');
+	out.resize(decode(s.data(), s.size(), out.data()));
+	return out;
+}
+
+static std::string encode_with(std::size_t (*length)(const char32_t*, std::size_t, utf8::invalid_code_point),
+	std::size_t (*encode)(const char32_t*, std::size_t, char*, utf8::invalid_code_point),
+	const std::u32string& s, utf8::invalid_code_point policy)
+{
+	std::string out(length(s.data(), s.size(), policy), '\0');
+	assert(encode(s.data(), s.size(), out.data(), policy) == out.size());
+	return out;
+}
+
+int main()
+{
+	// 标量的参照实现: 最大子部分, 每个错误换成一个 U+FFFD
+	assert(decode_with(utf8::decode_scalar<char32_t>, "a\xE4\xB8" "b") == U"a�b");
+	assert(decode_with(utf8::decode_scalar<char32_t>, "\xC0\xAF") == U"��");
+	assert(decode_with(utf8::decode_scalar<char32_t>, "\xED\xA0\x80") == U"���");
+	assert(decode_with(utf8::decode_scalar<char32_t>, "\xF0\x9F\x98\x80") == U"\U0001F600");
+	assert(utf8::validate_scalar("\xEF\xBF\xBD", 3));
+	assert(!utf8::validate_scalar("\xF4\x90\x80\x80", 4));
+
+	std::mt19937 rng(20261019);
+	std::vector<std::string> inputs;
+	for (int i = 0; i < 20000; i++)
+		inputs.push_back(random_utf8(rng));
+
+	std::size_t checked_paths = 0;
+#ifdef UTF8_CODEC_X86
+	__builtin_cpu_init();
+	struct path
+	{
+		const char* name;
+		bool supported;
+		std::size_t (*decode)(const char*, std::size_t, char32_t*);
+		bool (*validate)(const char*, std::size_t);
+	};
+	const path paths[] = {
+		{"ssse3", __builtin_cpu_supports("ssse3") != 0, utf8::detail::decode_ssse3<char32_t>, utf8::detail::validate_ssse3},
+		{"avx2", __builtin_cpu_supports("avx2") != 0, utf8::detail::decode_avx2<char32_t>, utf8::detail::validate_avx2},
+	};
+
+	// 解码和校验: 向量化的结果必须和标量的一模一样
+	for (auto& p : paths)
+	{
+		if (!p.supported)
+		{
+			std::printf("%s not supported, skipped\n", p.name);
+			continue;
+		}
+		checked_paths++;
+		for (auto& s : inputs)
+		{
+			assert(decode_with(p.decode, s) == decode_with(utf8::decode_scalar<char32_t>, s));
+			assert(p.validate(s.data(), s.size()) == utf8::validate_scalar(s.data(), s.size()));
+		}
+	}
+
+	// 编码: 随机码点里有代理区和超出范围的值, 两种策略都要一样
+	if (__builtin_cpu_supports("ssse3"))
+	{
+		for (int i = 0; i < 20000; i++)
+		{
+			std::u32string cps(rng() % 40, U'\0');
+			for (auto& cp : cps)
+			{
+				switch (rng() % 6)
+				{
+				case 0: cp = rng() % 0x80; break;
+				case 1: cp = 0x80 + rng() % 0x780; break;
+				case 2: cp = 0x4E00 + rng() % 0x5200; break;
+				case 3: cp = 0xD800 + rng() % 0x800; break;
+				case 4: cp = 0x10000 + rng() % 0x100000; break;
+				default: cp = static_cast<char32_t>(rng()); break;
+				}
+			}
+			for (auto policy : {utf8::invalid_code_point::replace, utf8::invalid_code_point::skip})
+			{
+				assert(encode_with(utf8::detail::encoded_length_ssse3<char32_t>, utf8::detail::encode_ssse3<char32_t>, cps, policy)
+					== encode_with(utf8::encoded_length_scalar<char32_t>, utf8::encode_scalar<char32_t>, cps, policy));
+			}
+		}
+	}
+#endif
+
+	// 解码再编码: 合法的输入原样回来
+	for (auto& s : inputs)
+	{
+		if (!utf8::validate(s.data(), s.size()))
+			continue;
+		auto cps = decode_with(utf8::decode<char32_t>, s);
+		std::string back(utf8::encoded_length(cps.data(), cps.size()), '\0');
+		back.resize(utf8::encode(cps.data(), cps.size(), back.data()));
+		assert(back == s);
+	}
+
+	std::printf("%zu inputs, %zu vector paths checked\n", inputs.size(), checked_paths);
+	return 0;
+}
@@ -0,0 +1,573 @@
+﻿
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define UTF8_CODEC_X86 1
+#endif
+
+// UTF-8 和 UTF-32 (char32_t, 或者 Linux 上 32 位的 wchar_t) 之间的转换.
+//
+// 编码分两遍: 先按范围给码点分类算出确切的字节数, 调用者一次分配好, 再整块写进去.
+// 只输出合法的 UTF-8, 代理区和超出 U+10FFFF 的值按 invalid_code_point 换掉或者丢掉.
+// 解码会校验: 只接受 Unicode 标准 表 3-7 里的合法序列, 过长的编码, 代理区, 超出 U+10FFFF 的,
+// 截断的, 以及早就作废了的 5/6 字节形式都不认.
+// 出错的地方按 "最大子部分" 的规则换成 U+FFFD: 一个合法序列的开头, 连同后面还能接上的字节, 算一个错误.
+// 只想知道是不是合法的 UTF-8 (不是的话多半是 GBK/Big5 之类的老编码) 用 validate, 不用写出码点.
+//
+// 文件名大多数是 ASCII 加上一段段的中日韩文字, 所以向量化的路径只管这两种:
+// 一次 16/32 字节的 ASCII, 以及连续的 3 字节序列 (一次 4 个字符). 其余的交给标量的实现.
+// 标量实现也是参照实现, 向量化的路径结果必须和它一模一样.
+// 用哪个实现是运行时按 CPU 决定的.
+namespace utf8
+{
+	inline constexpr char32_t replacement_character = 0xFFFD;
+
+	// 解码 s 开头的一个序列, 返回吃掉的字节数 (至少是 1), 码点写进 cp
+	inline std::size_t decode_one(const unsigned char* s, std::size_t n, char32_t& cp)
+	{
+		unsigned c = s[0];
+		if (c < 0x80)
+		{
+			cp = c;
+			return 1;
+		}
+
+		std::size_t need;
+		// 第二个字节的合法范围, 用来排除过长编码, 代理区和超出 U+10FFFF 的码点
+		unsigned lo = 0x80, hi = 0xBF;
+		char32_t value;
+		if (c >= 0xC2 && c <= 0xDF)
+		{
+			need = 1;
+			value = c & 0x1F;
+		}
+		else if (c >= 0xE0 && c <= 0xEF)
+		{
+			need = 2;
+			value = c & 0x0F;
+			if (c == 0xE0)
+				lo = 0xA0;
+			else if (c == 0xED)
+				hi = 0x9F;
+		}
+		else if (c >= 0xF0 && c <= 0xF4)
+		{
+			need = 3;
+			value = c & 0x07;
+			if (c == 0xF0)
+				lo = 0x90;
+			else if (c == 0xF4)
+				hi = 0x8F;
+		}
+		else
+		{
+			// 单独的后续字节, C0/C1, F5 以上
+			cp = replacement_character;
+			return 1;
+		}
+
+		std::size_t i = 1;
+		for (; i <= need && i < n; i++)
+		{
+			unsigned b = s[i];
+			if (b < lo || b > hi)
+				break;
+			value = value << 6 | (b & 0x3F);
+			lo = 0x80;
+			hi = 0xBF;
+		}
+
+		cp = i == need + 1 ? value : replacement_character;
+		return i;
+	}
+
+	// 标量的参照实现. out 至少要有 n 个位置, 返回写了多少个码点
+	template<typename Char32>
+	std::size_t decode_scalar(const char* s, std::size_t n, Char32* out)
+	{
+		auto p = reinterpret_cast<const unsigned char*>(s);
+		std::size_t i = 0, o = 0;
+		while (i < n)
+		{
+			char32_t cp;
+			i += decode_one(p + i, n - i, cp);
+			out[o++] = static_cast<Char32>(cp);
+		}
+		return o;
+	}
+
+#ifdef UTF8_CODEC_X86
+	namespace detail
+	{
+		// p 开头的 12 个字节如果是 4 个 3 字节序列, 解码成 4 个码点写到 out.
+		// 返回从头开始连续合法的序列个数, out 的 4 个位置总是都会被写.
+		__attribute__((target("ssse3"))) inline unsigned decode_three_byte_x4(const unsigned char* p, void* out)
+		{
+			auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			// 每个 32 位的格子里放 (第一个字节 << 16) | (第二个字节 << 8) | 第三个字节
+			auto x = _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1));
+			auto shape_ok = _mm_cmpeq_epi32(_mm_and_si128(x, _mm_set1_epi32(0x00F0C0C0)), _mm_set1_epi32(0x00E08080));
+
+			auto cp = _mm_or_si128(
+				_mm_or_si128(
+					_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(x, 16), _mm_set1_epi32(0x0F)), 12),
+					_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(x, 8), _mm_set1_epi32(0x3F)), 6)),
+				_mm_and_si128(x, _mm_set1_epi32(0x3F)));
+
+			// 过长编码 (< U+0800) 和代理区 (U+D800..U+DFFF)
+			auto overlong = _mm_cmplt_epi32(cp, _mm_set1_epi32(0x800));
+			auto surrogate = _mm_cmpeq_epi32(_mm_and_si128(cp, _mm_set1_epi32(0xF800)), _mm_set1_epi32(0xD800));
+			auto ok = _mm_andnot_si128(_mm_or_si128(overlong, surrogate), shape_ok);
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), cp);
+			auto mask = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(ok)));
+			return static_cast<unsigned>(std::countr_one(mask));
+		}
+
+		// 16 个 ASCII 字节扩展成 16 个码点
+		__attribute__((target("ssse3"))) inline void widen_ascii_x16(__m128i v, void* out)
+		{
+			auto zero = _mm_setzero_si128();
+			auto lo = _mm_unpacklo_epi8(v, zero);
+			auto hi = _mm_unpackhi_epi8(v, zero);
+			auto dst = reinterpret_cast<__m128i*>(out);
+			_mm_storeu_si128(dst + 0, _mm_unpacklo_epi16(lo, zero));
+			_mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(lo, zero));
+			_mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(hi, zero));
+			_mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(hi, zero));
+		}
+
+		// 每一轮先看 16 个字节: 开头有几个 ASCII 就前进几个 (16 个全部先扩展写出去, 写多了的下一轮会覆盖);
+		// 一个 ASCII 都没有就试 4 个 3 字节序列; 还不行就标量解码一个序列.
+		// 只要还剩至少 16 个字节, out 就一定还有至少 16 个空位 (每个码点至少吃一个字节), 多写不会越界
+		template<typename Char32>
+		__attribute__((target("ssse3"))) std::size_t decode_ssse3(const char* s, std::size_t n, Char32* out)
+		{
+			static_assert(sizeof(Char32) == 4);
+			auto p = reinterpret_cast<const unsigned char*>(s);
+			std::size_t i = 0, o = 0;
+			while (i + 16 <= n)
+			{
+				auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+				auto non_ascii = static_cast<unsigned>(_mm_movemask_epi8(v));
+				if (non_ascii != 0xFFFF)
+				{
+					widen_ascii_x16(v, out + o);
+					auto ascii = non_ascii == 0 ? 16u : static_cast<unsigned>(std::countr_zero(non_ascii));
+					if (ascii)
+					{
+						i += ascii;
+						o += ascii;
+						continue;
+					}
+				}
+
+				if (auto k = decode_three_byte_x4(p + i, out + o))
+				{
+					i += 3 * k;
+					o += k;
+					continue;
+				}
+
+				char32_t cp;
+				i += decode_one(p + i, n - i, cp);
+				out[o++] = static_cast<Char32>(cp);
+			}
+			return o + decode_scalar(s + i, n - i, out + o);
+		}
+
+		// 和 decode_ssse3 一样, ASCII 一次看 32 个字节
+		template<typename Char32>
+		__attribute__((target("avx2"))) std::size_t decode_avx2(const char* s, std::size_t n, Char32* out)
+		{
+			static_assert(sizeof(Char32) == 4);
+			auto p = reinterpret_cast<const unsigned char*>(s);
+			std::size_t i = 0, o = 0;
+			while (i + 32 <= n)
+			{
+				auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+				auto non_ascii = static_cast<std::uint32_t>(_mm256_movemask_epi8(v));
+				auto ascii = non_ascii == 0 ? 32u : static_cast<unsigned>(std::countr_zero(non_ascii));
+				if (ascii)
+				{
+					auto dst = reinterpret_cast<__m256i*>(out + o);
+					auto lo = _mm256_castsi256_si128(v);
+					auto hi = _mm256_extracti128_si256(v, 1);
+					_mm256_storeu_si256(dst + 0, _mm256_cvtepu8_epi32(lo));
+					_mm256_storeu_si256(dst + 1, _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+					if (ascii > 16)
+					{
+						_mm256_storeu_si256(dst + 2, _mm256_cvtepu8_epi32(hi));
+						_mm256_storeu_si256(dst + 3, _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+					}
+					i += ascii;
+					o += ascii;
+					continue;
+				}
+
+				if (auto k = decode_three_byte_x4(p + i, out + o))
+				{
+					i += 3 * k;
+					o += k;
+					continue;
+				}
+
+				char32_t cp;
+				i += decode_one(p + i, n - i, cp);
+				out[o++] = static_cast<Char32>(cp);
+			}
+			return o + decode_ssse3(s + i, n - i, out + o);
+		}
+
+		template<typename Char32>
+		using decode_function = std::size_t (*)(const char*, std::size_t, Char32*);
+
+		template<typename Char32>
+		decode_function<Char32> select_decoder()
+		{
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2"))
+				return decode_avx2<Char32>;
+			if (__builtin_cpu_supports("ssse3"))
+				return decode_ssse3<Char32>;
+			return decode_scalar<Char32>;
+		}
+	}
+#endif
+
+	// 把 n 个字节的 UTF-8 解码到 out, out 至少要有 n 个位置. 返回写了多少个码点
+	template<typename Char32>
+	std::size_t decode(const char* s, std::size_t n, Char32* out)
+	{
+		static_assert(sizeof(Char32) == 4);
+#ifdef UTF8_CODEC_X86
+		static const auto decoder = detail::select_decoder<Char32>();
+		return decoder(s, n, out);
+#else
+		return decode_scalar(s, n, out);
+#endif
+	}
+
+	// s 开头的一个序列合法的话返回它的字节数, 不合法返回 0.
+	// decode_one 出错的时候码点是 U+FFFD, 而合法的 U+FFFD 只能是 EF BF BD; EF 开头的错误最多吃两个字节, 所以分得开
+	inline std::size_t valid_length_one(const unsigned char* s, std::size_t n)
+	{
+		char32_t cp;
+		auto length = decode_one(s, n, cp);
+		if (cp == replacement_character && (length != 3 || s[0] != 0xEF))
+			return 0;
+		return length;
+	}
+
+	// 标量的参照实现
+	inline bool validate_scalar(const char* s, std::size_t n)
+	{
+		auto p = reinterpret_cast<const unsigned char*>(s);
+		for (std::size_t i = 0; i < n;)
+		{
+			auto length = valid_length_one(p + i, n - i);
+			if (length == 0)
+				return false;
+			i += length;
+		}
+		return true;
+	}
+
+#ifdef UTF8_CODEC_X86
+	namespace detail
+	{
+		// 和 decode_ssse3 的路子一样, 只是码点写到一个扔掉的缓冲区里
+		__attribute__((target("ssse3"))) inline bool validate_ssse3(const char* s, std::size_t n)
+		{
+			auto p = reinterpret_cast<const unsigned char*>(s);
+			alignas(16) char32_t discard[4];
+			std::size_t i = 0;
+			while (i + 16 <= n)
+			{
+				auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+				auto non_ascii = static_cast<unsigned>(_mm_movemask_epi8(v));
+				auto ascii = non_ascii == 0 ? 16u : static_cast<unsigned>(std::countr_zero(non_ascii));
+				if (ascii)
+				{
+					i += ascii;
+					continue;
+				}
+
+				if (auto k = decode_three_byte_x4(p + i, discard))
+				{
+					i += 3 * k;
+					continue;
+				}
+
+				auto length = valid_length_one(p + i, n - i);
+				if (length == 0)
+					return false;
+				i += length;
+			}
+			return validate_scalar(s + i, n - i);
+		}
+
+		__attribute__((target("avx2"))) inline bool validate_avx2(const char* s, std::size_t n)
+		{
+			auto p = reinterpret_cast<const unsigned char*>(s);
+			alignas(16) char32_t discard[4];
+			std::size_t i = 0;
+			while (i + 32 <= n)
+			{
+				auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+				auto non_ascii = static_cast<std::uint32_t>(_mm256_movemask_epi8(v));
+				auto ascii = non_ascii == 0 ? 32u : static_cast<unsigned>(std::countr_zero(non_ascii));
+				if (ascii)
+				{
+					i += ascii;
+					continue;
+				}
+
+				if (auto k = decode_three_byte_x4(p + i, discard))
+				{
+					i += 3 * k;
+					continue;
+				}
+
+				auto length = valid_length_one(p + i, n - i);
+				if (length == 0)
+					return false;
+				i += length;
+			}
+			return validate_ssse3(s + i, n - i);
+		}
+
+		inline bool (*select_validator())(const char*, std::size_t)
+		{
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2"))
+				return validate_avx2;
+			if (__builtin_cpu_supports("ssse3"))
+				return validate_ssse3;
+			return validate_scalar;
+		}
+	}
+#endif
+
+	// n 个字节是不是合法的 UTF-8
+	inline bool validate(const char* s, std::size_t n)
+	{
+#ifdef UTF8_CODEC_X86
+		static const auto validator = detail::select_validator();
+		return validator(s, n);
+#else
+		return validate_scalar(s, n);
+#endif
+	}
+	// 编码的时候碰到代理区 (U+D800..U+DFFF) 或者超出 U+10FFFF 的值怎么办.
+	// 这些值没有合法的 UTF-8 形式, 不会像以前那样编码成 5/6 字节或者 CESU 式的代理字节
+	enum class invalid_code_point
+	{
+		// 换成 U+FFFD
+		replace,
+		// 直接丢掉
+		skip,
+	};
+
+	// 一个码点编码以后的字节数, 0 表示丢掉
+	inline std::size_t encoded_length_one(std::uint32_t cp, invalid_code_point policy)
+	{
+		if (cp < 0x80)
+			return 1;
+		if (cp < 0x800)
+			return 2;
+		bool invalid = (cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF;
+		if (invalid)
+			return policy == invalid_code_point::replace ? 3 : 0;
+		return cp < 0x10000 ? 3 : 4;
+	}
+
+	// 编码一个码点, 返回写完以后的位置
+	inline char* encode_one(std::uint32_t cp, char* out, invalid_code_point policy)
+	{
+		if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF)
+		{
+			if (policy == invalid_code_point::skip)
+				return out;
+			cp = replacement_character;
+		}
+
+		if (cp < 0x80)
+		{
+			*out++ = static_cast<char>(cp);
+		}
+		else if (cp < 0x800)
+		{
+			*out++ = static_cast<char>(0xC0 | cp >> 6);
+			*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else if (cp < 0x10000)
+		{
+			*out++ = static_cast<char>(0xE0 | cp >> 12);
+			*out++ = static_cast<char>(0x80 | (cp >> 6 & 0x3F));
+			*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else
+		{
+			*out++ = static_cast<char>(0xF0 | cp >> 18);
+			*out++ = static_cast<char>(0x80 | (cp >> 12 & 0x3F));
+			*out++ = static_cast<char>(0x80 | (cp >> 6 & 0x3F));
+			*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		return out;
+	}
+
+	// 标量的参照实现
+	template<typename Char32>
+	std::size_t encoded_length_scalar(const Char32* s, std::size_t n, invalid_code_point policy)
+	{
+		std::size_t length = 0;
+		for (std::size_t i = 0; i < n; i++)
+			length += encoded_length_one(static_cast<std::uint32_t>(s[i]), policy);
+		return length;
+	}
+
+	template<typename Char32>
+	std::size_t encode_scalar(const Char32* s, std::size_t n, char* out, invalid_code_point policy)
+	{
+		auto begin = out;
+		for (std::size_t i = 0; i < n; i++)
+			out = encode_one(static_cast<std::uint32_t>(s[i]), out, policy);
+		return static_cast<std::size_t>(out - begin);
+	}
+
+#ifdef UTF8_CODEC_X86
+	namespace detail
+	{
+		// 一次 4 个码点按范围分类, 累加编码以后的长度.
+		// 当作有符号数比较: 大于 0x7FFFFFFF 的值是负数, 和超出 U+10FFFF 的一样算不合法
+		template<typename Char32>
+		__attribute__((target("ssse3"))) std::size_t encoded_length_ssse3(const Char32* s, std::size_t n, invalid_code_point policy)
+		{
+			static_assert(sizeof(Char32) == 4);
+			auto invalid_length = _mm_set1_epi32(policy == invalid_code_point::replace ? 3 : 0);
+			auto sum = _mm_setzero_si128();
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4)
+			{
+				auto cp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+				// 比较的结果是 -1, 减掉就是加一
+				auto length = _mm_sub_epi32(_mm_set1_epi32(1), _mm_cmpgt_epi32(cp, _mm_set1_epi32(0x7F)));
+				length = _mm_sub_epi32(length, _mm_cmpgt_epi32(cp, _mm_set1_epi32(0x7FF)));
+				length = _mm_sub_epi32(length, _mm_cmpgt_epi32(cp, _mm_set1_epi32(0xFFFF)));
+
+				auto surrogate = _mm_cmpeq_epi32(_mm_and_si128(cp, _mm_set1_epi32(0xFFFFF800)), _mm_set1_epi32(0xD800));
+				auto out_of_range = _mm_or_si128(_mm_cmpgt_epi32(cp, _mm_set1_epi32(0x10FFFF)), _mm_cmplt_epi32(cp, _mm_setzero_si128()));
+				auto invalid = _mm_or_si128(surrogate, out_of_range);
+				length = _mm_or_si128(_mm_andnot_si128(invalid, length), _mm_and_si128(invalid, invalid_length));
+				sum = _mm_add_epi32(sum, length);
+			}
+
+			// 每个格子每轮最多加 4, 要 2^30 轮才会溢出 32 位
+			alignas(16) std::uint32_t lanes[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes), sum);
+			std::size_t length = std::size_t{lanes[0]} + lanes[1] + lanes[2] + lanes[3];
+			return length + encoded_length_scalar(s + i, n - i, policy);
+		}
+
+		// 输出的空间正好够, 所以每一步都只写它该写的字节数
+		template<typename Char32>
+		__attribute__((target("ssse3"))) std::size_t encode_ssse3(const Char32* s, std::size_t n, char* out, invalid_code_point policy)
+		{
+			static_assert(sizeof(Char32) == 4);
+			auto begin = out;
+			std::size_t i = 0;
+			while (i + 4 <= n)
+			{
+				auto cp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+
+				// 4 个都是 ASCII: 压成 4 个字节
+				auto ascii = _mm_cmpeq_epi32(_mm_and_si128(cp, _mm_set1_epi32(~0x7F)), _mm_setzero_si128());
+				if (_mm_movemask_epi8(ascii) == 0xFFFF)
+				{
+					auto bytes = _mm_shuffle_epi8(cp, _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+					auto word = static_cast<std::uint32_t>(_mm_cvtsi128_si32(bytes));
+					std::memcpy(out, &word, 4);
+					out += 4;
+					i += 4;
+					continue;
+				}
+
+				// 4 个都是 U+0800..U+FFFF 而且不是代理: 每个 3 字节, 一共 12 个
+				auto three_byte = _mm_and_si128(
+					_mm_cmpgt_epi32(cp, _mm_set1_epi32(0x7FF)),
+					_mm_cmplt_epi32(cp, _mm_set1_epi32(0x10000)));
+				auto surrogate = _mm_cmpeq_epi32(_mm_and_si128(cp, _mm_set1_epi32(0xFFFFF800)), _mm_set1_epi32(0xD800));
+				if (_mm_movemask_epi8(_mm_andnot_si128(surrogate, three_byte)) == 0xFFFF)
+				{
+					// 每个格子里拼成 byte0 | byte1 << 8 | byte2 << 16
+					auto byte0 = _mm_or_si128(_mm_srli_epi32(cp, 12), _mm_set1_epi32(0xE0));
+					auto byte1 = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(cp, 6), _mm_set1_epi32(0x3F)), _mm_set1_epi32(0x80));
+					auto byte2 = _mm_or_si128(_mm_and_si128(cp, _mm_set1_epi32(0x3F)), _mm_set1_epi32(0x80));
+					auto lanes = _mm_or_si128(byte0, _mm_or_si128(_mm_slli_epi32(byte1, 8), _mm_slli_epi32(byte2, 16)));
+					auto packed = _mm_shuffle_epi8(lanes, _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+					alignas(16) char bytes[16];
+					_mm_store_si128(reinterpret_cast<__m128i*>(bytes), packed);
+					std::memcpy(out, bytes, 12);
+					out += 12;
+					i += 4;
+					continue;
+				}
+
+				out = encode_one(static_cast<std::uint32_t>(s[i]), out, policy);
+				i++;
+			}
+			out += encode_scalar(s + i, n - i, out, policy);
+			return static_cast<std::size_t>(out - begin);
+		}
+
+		template<typename Char32>
+		struct encoder
+		{
+			std::size_t (*length)(const Char32*, std::size_t, invalid_code_point);
+			std::size_t (*encode)(const Char32*, std::size_t, char*, invalid_code_point);
+		};
+
+		template<typename Char32>
+		encoder<Char32> select_encoder()
+		{
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("ssse3"))
+				return {encoded_length_ssse3<Char32>, encode_ssse3<Char32>};
+			return {encoded_length_scalar<Char32>, encode_scalar<Char32>};
+		}
+	}
+#endif
+
+	// 编码以后正好多少字节, 先用这个算好长度, 一次分配够, 再 encode
+	template<typename Char32>
+	std::size_t encoded_length(const Char32* s, std::size_t n, invalid_code_point policy = invalid_code_point::replace)
+	{
+		static_assert(sizeof(Char32) == 4);
+#ifdef UTF8_CODEC_X86
+		static const auto encoder = detail::select_encoder<Char32>();
+		return encoder.length(s, n, policy);
+#else
+		return encoded_length_scalar(s, n, policy);
+#endif
+	}
+
+	// out 要有 encoded_length 那么多的空间, 返回写了多少字节
+	template<typename Char32>
+	std::size_t encode(const Char32* s, std::size_t n, char* out, invalid_code_point policy = invalid_code_point::replace)
+	{
+		static_assert(sizeof(Char32) == 4);
+#ifdef UTF8_CODEC_X86
+		static const auto encoder = detail::select_encoder<Char32>();
+		return encoder.encode(s, n, out, policy);
+#else
+		return encode_scalar(s, n, out, policy);
+#endif
+	}
+}